@@ -0,0 +1,204 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#include "SyntheticMesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <utility>
+
+#include "tinyply.h"
+
+// uniform in [0, 1), from a 64 bit LCG so meshes do not depend on the
+// standard library's distributions
+static float Uniform(uint64_t& state) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return (state >> 40) / static_cast<float>(1 << 24);
+}
+
+static Eigen::Vector3i GetClassColor(const uint16_t class_i) {
+    return Eigen::Vector3i((class_i * 67) % 256, (class_i * 131) % 256, (class_i * 197) % 256);
+}
+
+// grid of nu x nv quads spanning origin + [0, 1] u + [0, 1] v, two triangles
+// each. Vertices are moved by up to jitter in every direction
+static void AddQuadGrid(SyntheticMesh& mesh,
+                        const Eigen::Vector3f& origin,
+                        const Eigen::Vector3f& u,
+                        const Eigen::Vector3f& v,
+                        const float spacing,
+                        const uint16_t class_i,
+                        const float jitter,
+                        uint64_t& state) {
+    const int nu = std::max(1, static_cast<int>(std::round(u.norm() / spacing)));
+    const int nv = std::max(1, static_cast<int>(std::round(v.norm() / spacing)));
+    const uint32_t first = mesh.vertices.size();
+    for (int j = 0; j <= nv; j++) {
+        for (int i = 0; i <= nu; i++) {
+            const Eigen::Vector3f offset(Uniform(state) - 0.5f, Uniform(state) - 0.5f, Uniform(state) - 0.5f);
+            mesh.vertices.push_back(origin + u * (static_cast<float>(i) / nu) + v * (static_cast<float>(j) / nv) +
+                                    2 * jitter * offset);
+            mesh.classes.push_back(class_i);
+            mesh.colors.push_back(GetClassColor(class_i));
+        }
+    }
+    for (int j = 0; j < nv; j++) {
+        for (int i = 0; i < nu; i++) {
+            const uint32_t corner = first + j * (nu + 1) + i;
+            const uint32_t quad[4] = { corner, corner + 1, corner + nu + 2, corner + nu + 1 };
+            mesh.faces.insert(mesh.faces.end(), { quad[0], quad[1], quad[2], quad[0], quad[2], quad[3] });
+        }
+    }
+}
+
+Eigen::Vector3f SyntheticMesh::GetMin() const {
+    Eigen::Vector3f min = vertices.front();
+    for (const auto& vertex: vertices)
+        min = min.cwiseMin(vertex);
+    return min;
+}
+
+Eigen::Vector3f SyntheticMesh::GetMax() const {
+    Eigen::Vector3f max = vertices.front();
+    for (const auto& vertex: vertices)
+        max = max.cwiseMax(vertex);
+    return max;
+}
+
+bool SyntheticMesh::SaveAsPLY(const std::string& filepath) const {
+    std::vector<float> positions;
+    std::vector<uint8_t> rgba;
+    std::vector<uint16_t> labels(classes);
+    std::vector<int32_t> indices(faces.begin(), faces.end());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        positions.insert(positions.end(), { vertices[i][0], vertices[i][1], vertices[i][2] });
+        rgba.insert(rgba.end(), { static_cast<uint8_t>(colors[i][0]), static_cast<uint8_t>(colors[i][1]),
+                                  static_cast<uint8_t>(colors[i][2]), 255 });
+    }
+    std::filebuf fb;
+    if (!fb.open(filepath, std::ios::out | std::ios::binary))
+        return false;
+    std::ostream os(&fb);
+    tinyply::PlyFile out_file;
+    out_file.add_properties_to_element("vertex", { "x", "y", "z" }, positions);
+    out_file.add_properties_to_element("vertex", { "red", "green", "blue", "alpha" }, rgba);
+    out_file.add_properties_to_element("vertex", { "label" }, labels);
+    out_file.add_properties_to_element("face", { "vertex_indices" }, indices, 3, tinyply::PlyProperty::Type::UINT8);
+    out_file.write(os, true);
+    fb.close();
+    return true;
+}
+
+SyntheticMesh CreatePlane(const float extent, const float spacing) {
+    SyntheticMesh mesh;
+    mesh.name = "plane";
+    uint64_t state = 1;
+    // tilted off every axis, so faces cross voxel boundaries at all angles
+    const Eigen::Matrix3f rotation = Eigen::AngleAxisf(0.5f, Eigen::Vector3f(1, 2, 0).normalized()).toRotationMatrix();
+    AddQuadGrid(mesh, Eigen::Vector3f::Zero(), rotation * Eigen::Vector3f(extent, 0, 0),
+                rotation * Eigen::Vector3f(0, extent, 0), spacing, 1, 0, state);
+    return mesh;
+}
+
+SyntheticMesh CreateSphere(const float radius, const int subdivisions) {
+    SyntheticMesh mesh;
+    mesh.name = "sphere";
+    const float t = (1 + std::sqrt(5.0f)) / 2;
+    const float icosahedron_vertices[12][3] = {
+        { -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+        { 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+        { t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 }
+    };
+    for (const auto& vertex: icosahedron_vertices)
+        mesh.vertices.push_back(Eigen::Vector3f(vertex[0], vertex[1], vertex[2]).normalized());
+    mesh.faces = { 0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11,
+                   1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+                   3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9,
+                   4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1 };
+    for (int level = 0; level < subdivisions; level++) {
+        std::map<std::pair<uint32_t, uint32_t>, uint32_t> midpoints;
+        auto get_midpoint = [&](const uint32_t a, const uint32_t b) {
+            const std::pair<uint32_t, uint32_t> edge(std::min(a, b), std::max(a, b));
+            const auto found = midpoints.find(edge);
+            if (found != midpoints.end())
+                return found->second;
+            mesh.vertices.push_back((mesh.vertices[a] + mesh.vertices[b]).normalized());
+            midpoints[edge] = mesh.vertices.size() - 1;
+            return static_cast<uint32_t>(mesh.vertices.size() - 1);
+        };
+        std::vector<uint32_t> faces;
+        for (size_t i = 0; i < mesh.faces.size(); i += 3) {
+            const uint32_t a = mesh.faces[i], b = mesh.faces[i+1], c = mesh.faces[i+2];
+            const uint32_t ab = get_midpoint(a, b), bc = get_midpoint(b, c), ca = get_midpoint(c, a);
+            faces.insert(faces.end(), { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca });
+        }
+        mesh.faces.swap(faces);
+    }
+    // classes by octant
+    for (auto& vertex: mesh.vertices) {
+        const uint16_t class_i = 1 + (vertex[0] > 0) + 2 * (vertex[1] > 0) + 4 * (vertex[2] > 0);
+        vertex *= radius;
+        mesh.classes.push_back(class_i);
+        mesh.colors.push_back(GetClassColor(class_i));
+    }
+    return mesh;
+}
+
+SyntheticMesh CreateSlivers(const int num_slivers, const float length, const float width) {
+    SyntheticMesh mesh;
+    mesh.name = "slivers";
+    uint64_t state = 3;
+    for (int i = 0; i < num_slivers; i++) {
+        const Eigen::Vector3f center(2 * Uniform(state), 2 * Uniform(state), 2 * Uniform(state));
+        const Eigen::Vector3f direction = Eigen::Vector3f(Uniform(state) - 0.5f, Uniform(state) - 0.5f,
+                                                          Uniform(state) - 0.5f).normalized();
+        const Eigen::Vector3f across = direction.unitOrthogonal();
+        const uint32_t first = mesh.vertices.size();
+        mesh.vertices.push_back(center - direction * (length / 2));
+        mesh.vertices.push_back(center + direction * (length / 2));
+        mesh.vertices.push_back(center + across * width);
+        const uint16_t class_i = 1 + i % 20;
+        for (int j = 0; j < 3; j++) {
+            mesh.faces.push_back(first + j);
+            mesh.classes.push_back(class_i);
+            mesh.colors.push_back(GetClassColor(class_i));
+        }
+    }
+    return mesh;
+}
+
+SyntheticMesh CreateRoom(const Eigen::Vector3f& size, const int num_objects, const float spacing) {
+    SyntheticMesh mesh;
+    mesh.name = "room";
+    uint64_t state = 7;
+    const float jitter = 0.003f;
+    const Eigen::Vector3f x(size[0], 0, 0), y(0, size[1], 0), z(0, 0, size[2]);
+    // floor, then walls, no ceiling as in scans
+    AddQuadGrid(mesh, Eigen::Vector3f::Zero(), x, y, spacing, 1, jitter, state);
+    AddQuadGrid(mesh, Eigen::Vector3f::Zero(), x, z, spacing, 2, jitter, state);
+    AddQuadGrid(mesh, y, x, z, spacing, 2, jitter, state);
+    AddQuadGrid(mesh, Eigen::Vector3f::Zero(), y, z, spacing, 2, jitter, state);
+    AddQuadGrid(mesh, x, y, z, spacing, 2, jitter, state);
+    // boxes standing on the floor, without their bottom face
+    for (int i = 0; i < num_objects; i++) {
+        const Eigen::Vector3f box_size(0.3f + 0.9f * Uniform(state), 0.3f + 0.9f * Uniform(state),
+                                       0.4f + 0.6f * Uniform(state));
+        const Eigen::Vector3f corner((size[0] - box_size[0]) * Uniform(state),
+                                     (size[1] - box_size[1]) * Uniform(state), 0);
+        const Eigen::Vector3f bx(box_size[0], 0, 0), by(0, box_size[1], 0), bz(0, 0, box_size[2]);
+        const uint16_t class_i = 3 + i;
+        AddQuadGrid(mesh, corner + bz, bx, by, spacing, class_i, jitter, state);
+        AddQuadGrid(mesh, corner, bx, bz, spacing, class_i, jitter, state);
+        AddQuadGrid(mesh, corner + by, bx, bz, spacing, class_i, jitter, state);
+        AddQuadGrid(mesh, corner, by, bz, spacing, class_i, jitter, state);
+        AddQuadGrid(mesh, corner + bx, by, bz, spacing, class_i, jitter, state);
+    }
+    return mesh;
+}
@@ -0,0 +1,44 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#ifndef __SYNTHETICMESH__
+#define __SYNTHETICMESH__
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+// Meshes for the benchmark suite, generated deterministically so timings can
+// be compared between builds and machines. Every vertex has a class and a
+// color, as if read from a ScanNet scene
+struct SyntheticMesh {
+    std::string name;
+    std::vector<Eigen::Vector3f> vertices;
+    std::vector<uint32_t> faces;
+    std::vector<uint16_t> classes;
+    std::vector<Eigen::Vector3i> colors;
+    
+    Eigen::Vector3f GetMin() const;
+    Eigen::Vector3f GetMax() const;
+    // binary PLY laid out like ScanNet's: x, y, z, red, green, blue, alpha and
+    // label per vertex, faces as lists with a uchar count and int indices
+    bool SaveAsPLY(const std::string& filepath) const;
+};
+
+// tilted square of side extent, tessellated into right triangles of side spacing
+SyntheticMesh CreatePlane(const float extent, const float spacing);
+// icosahedron subdivided subdivisions times, 20 * 4^subdivisions faces
+SyntheticMesh CreateSphere(const float radius, const int subdivisions);
+// long, thin triangles in random directions, the worst case for splitting
+SyntheticMesh CreateSlivers(const int num_slivers, const float length, const float width);
+// floor, walls and box-shaped furniture of a room, tessellated at about
+// ScanNet's resolution with jittered vertices, one class per object
+SyntheticMesh CreateRoom(const Eigen::Vector3f& size, const int num_objects, const float spacing);
+
+#endif /* defined(__SYNTHETICMESH__) */
@@ -0,0 +1,617 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ClassyVoxelizer.h"
+#include "ColoredVoxelGrid.h"
+#include "ColoredVoxelizer.h"
+#include "MultiClassVoxelGrid.h"
+#include "MultiClassVoxelizer.h"
+#include "SyntheticMesh.h"
+#include "VoxelFile.h"
+
+// heap allocations made by the whole process, for the allocation counts
+static std::atomic<size_t> num_allocations(0);
+
+void* operator new(size_t size) {
+    num_allocations++;
+    if (void* pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+// seconds taken by the fastest of num_runs calls
+template <typename Function>
+double TimeBest(const int num_runs, const Function& function) {
+    double best = 1e30;
+    for (int run = 0; run < num_runs; run++) {
+        const auto start = std::chrono::steady_clock::now();
+        function();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+// Traversal of a dense class grid with about 2% of voxels occupied on thin
+// shells, the way surface scans fill a grid. Compares the original x-outermost
+// loop (stride X*Y in the innermost loop) with storage order.
+void BenchmarkTraversal(const int size) {
+    const Eigen::Vector3i voxels_per_dim(size, size, size);
+    std::vector<uint8_t> grid(static_cast<size_t>(size) * size * size, 0);
+    for (size_t voxel_id = 0; voxel_id < grid.size(); voxel_id += 47)
+        grid[voxel_id] = 1 + voxel_id % 7;
+    
+    uint64_t checksum = 0;
+    const double x_outer = TimeBest(3, [&]() {
+        for (int i = 0; i < size; i++)
+            for (int j = 0; j < size; j++)
+                for (int k = 0; k < size; k++) {
+                    const size_t voxel_id = (static_cast<size_t>(k) * size + j) * size + i;
+                    if (grid[voxel_id] != 0)
+                        checksum += grid[voxel_id];
+                }
+    });
+    const double storage_order = TimeBest(3, [&]() {
+        for (int k = 0; k < size; k++)
+            for (int j = 0; j < size; j++)
+                for (int i = 0; i < size; i++) {
+                    const size_t voxel_id = (static_cast<size_t>(k) * size + j) * size + i;
+                    if (grid[voxel_id] != 0)
+                        checksum += grid[voxel_id];
+                }
+    });
+    const double num_voxels = static_cast<double>(grid.size());
+    std::cout << "traversal " << size << "^3, x outermost:  " << num_voxels / x_outer / 1e6 << " Mvoxels/s" << std::endl;
+    std::cout << "traversal " << size << "^3, storage order: " << num_voxels / storage_order / 1e6 << " Mvoxels/s"
+              << " (checksum " << checksum % 1000 << ")" << std::endl;
+}
+
+// SaveAsPLY of a MultiClassVoxelGrid, i.e. the occupancy scan plus writing
+void BenchmarkSaveAsPLY(const int size, const VoxelStorage storage) {
+    const float voxel_size = 0.01f;
+    const Eigen::Vector3f grid_min(0, 0, 0);
+    const Eigen::Vector3f grid_max = Eigen::Vector3f::Constant(size * voxel_size + voxel_size / 2);
+    MultiClassVoxelGrid voxel_grid(grid_min, grid_max, voxel_size, storage);
+    voxel_grid.class_color_mapping.resize(8, Eigen::Vector3i(10, 20, 30));
+    const VoxelID num_voxels = static_cast<VoxelID>(size) * size * size;
+    VoxelID num_occupied = 0;
+    for (VoxelID voxel_id = 0; voxel_id < num_voxels; voxel_id += 47, num_occupied++)
+        voxel_grid.SetVoxelClass(voxel_id, 1 + voxel_id % 7);
+    
+    const std::string file_name = "classy_voxelizer_bench.ply";
+    const double seconds = TimeBest(3, [&]() { voxel_grid.SaveAsPLY(file_name); });
+    std::remove(file_name.c_str());
+    std::cout << "SaveAsPLY " << size << "^3 " << (storage == VoxelStorage::dense ? "dense" : "sparse")
+              << ": " << num_voxels / seconds / 1e6 << " Mvoxels/s, "
+              << num_occupied / seconds / 1e6 << " Moccupied/s" << std::endl;
+}
+
+// peak resident set size of the process in MB
+static double GetPeakMemoryMB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1e6;
+#else
+    return usage.ru_maxrss / 1e3;
+#endif
+}
+
+// Memory of a dense ColoredVoxelGrid, measured as the growth of peak memory
+// while it is built so it has to run first, then stamping every 47th voxel
+// and SaveAsPLY
+void BenchmarkColorGrid(const int size) {
+    const float voxel_size = 0.01f;
+    const Eigen::Vector3f grid_min(0, 0, 0);
+    const Eigen::Vector3f grid_max = Eigen::Vector3f::Constant(size * voxel_size + voxel_size / 2);
+    const double memory_before = GetPeakMemoryMB();
+    ColoredVoxelGrid voxel_grid(grid_min, grid_max, voxel_size);
+    const double megabytes = GetPeakMemoryMB() - memory_before;
+    const VoxelID num_voxels = static_cast<VoxelID>(size) * size * size;
+    
+    const double stamp_seconds = TimeBest(3, [&]() {
+        for (VoxelID voxel_id = 0; voxel_id < num_voxels; voxel_id += 47)
+            voxel_grid.SetVoxelColor(voxel_id, Eigen::Vector3i(voxel_id % 256, 20, 30));
+    });
+    const std::string file_name = "classy_voxelizer_bench.ply";
+    const double save_seconds = TimeBest(3, [&]() { voxel_grid.SaveAsPLY(file_name); });
+    std::remove(file_name.c_str());
+    std::cout << "color grid " << size << "^3 dense: " << megabytes << " MB, stamping "
+              << num_voxels / 47 / stamp_seconds / 1e6 << " Mvoxels/s, SaveAsPLY "
+              << num_voxels / save_seconds / 1e6 << " Mvoxels/s" << std::endl;
+}
+
+// Concurrent stamping into atomic grids with majority aggregation, from 1 to
+// 64 threads. Spread: every thread stamps voxels all over a size^3 grid,
+// hot: all threads stamp the same 64 voxels, the worst case for contention
+void BenchmarkConcurrentWrites(const int size) {
+    const float voxel_size = 0.01f;
+    const Eigen::Vector3f grid_min(0, 0, 0);
+    const Eigen::Vector3f grid_max = Eigen::Vector3f::Constant(size * voxel_size + voxel_size / 2);
+    MultiClassVoxelGrid class_grid(grid_min, grid_max, voxel_size, VoxelStorage::atomic);
+    ColoredVoxelGrid color_grid(grid_min, grid_max, voxel_size, VoxelStorage::atomic);
+    class_grid.SetAggregation(VoxelAggregation::majority);
+    color_grid.SetAggregation(VoxelAggregation::majority);
+    const VoxelID num_voxels = static_cast<VoxelID>(size) * size * size;
+    const size_t num_writes = 1 << 24;
+    
+    for (const bool hot: { false, true }) {
+        for (int num_threads = 1; num_threads <= 64; num_threads *= 2) {
+            auto stamp = [&](const int thread_i) {
+                uint64_t state = 0x9E3779B97F4A7C15ull * (thread_i + 1);
+                for (size_t i = thread_i; i < num_writes; i += num_threads) {
+                    state = state * 6364136223846793005ull + 1442695040888963407ull;
+                    const VoxelID voxel_id = (state >> 24) % (hot ? 64 : num_voxels);
+                    class_grid.SetVoxelClass(voxel_id, 1 + (state >> 60));
+                    color_grid.SetVoxelColor(voxel_id, Eigen::Vector3i(state >> 56, (state >> 48) & 0xFF, 7));
+                }
+            };
+            const double seconds = TimeBest(3, [&]() {
+                std::vector<std::thread> threads;
+                for (int thread_i = 1; thread_i < num_threads; thread_i++)
+                    threads.emplace_back(stamp, thread_i);
+                stamp(0);
+                for (auto& thread: threads)
+                    thread.join();
+            });
+            std::cout << "concurrent writes " << (hot ? "hot" : "spread") << ", " << num_threads << " threads: "
+                      << num_writes / seconds / 1e6 << " Mwrites/s" << std::endl;
+        }
+    }
+}
+
+// Face splitting on a few large triangles at a fine voxel size, the case
+// where splitting dominates: 50 triangles of about 1 m at 5 mm voxels
+void BenchmarkSplit(const int num_threads) {
+    std::vector<Eigen::Vector3f> vertices;
+    std::vector<uint32_t> faces;
+    std::vector<uint16_t> classes;
+    std::vector<Eigen::Vector3i> colors;
+    for (uint32_t i = 0; i < 50; i++) {
+        const float z = 0.04f * i;
+        vertices.push_back(Eigen::Vector3f(0, 0, z));
+        vertices.push_back(Eigen::Vector3f(1, 0.1f * (i % 7), z));
+        vertices.push_back(Eigen::Vector3f(0.3f, 1, z + 0.5f));
+        for (uint32_t j = 0; j < 3; j++) {
+            faces.push_back(3 * i + j);
+            classes.push_back(1 + (i + j) % 5);
+            colors.push_back(Eigen::Vector3i(i % 256, 40 * j, 100));
+        }
+    }
+    const float voxel_size = 0.005f;
+    const Eigen::Vector3f grid_min = Eigen::Vector3f::Constant(-voxel_size);
+    const Eigen::Vector3f grid_max = Eigen::Vector3f(1, 1, 2.5f) + Eigen::Vector3f::Constant(voxel_size);
+    
+    MultiClassVoxelGrid class_grid(grid_min, grid_max, voxel_size);
+    MultiClassVoxelizer class_voxelizer;
+    class_voxelizer.SetNumThreads(num_threads);
+    std::vector<Eigen::Vector3f> class_vertices;
+    std::vector<uint16_t> vertex_classes;
+    size_t allocations = 0;
+    const double class_seconds = TimeBest(3, [&]() {
+        class_vertices = vertices;
+        vertex_classes = classes;
+        const size_t allocations_before = num_allocations;
+        class_voxelizer.Voxelize(class_grid, class_vertices, faces, vertex_classes);
+        allocations = num_allocations - allocations_before;
+    });
+    std::cout << "split " << num_threads << " threads, classes: " << class_seconds << " s, "
+              << allocations << " allocations, " << class_grid.GetNumOccupied() << " voxels" << std::endl;
+    
+    ColoredVoxelGrid color_grid(grid_min, grid_max, voxel_size);
+    ColoredVoxelizer color_voxelizer;
+    color_voxelizer.SetNumThreads(num_threads);
+    std::vector<Eigen::Vector3f> color_vertices;
+    std::vector<Eigen::Vector3i> vertex_colors;
+    const double color_seconds = TimeBest(3, [&]() {
+        color_vertices = vertices;
+        vertex_colors = colors;
+        const size_t allocations_before = num_allocations;
+        color_voxelizer.Voxelize(color_grid, color_vertices, faces, vertex_colors);
+        allocations = num_allocations - allocations_before;
+    });
+    std::cout << "split " << num_threads << " threads, colors: " << color_seconds << " s, "
+              << allocations << " allocations, " << color_grid.GetNumOccupied() << " voxels" << std::endl;
+}
+
+// Loading a binary PLY mesh laid out like ScanNet's: positions, colors and
+// labels per vertex and triangle faces
+void BenchmarkLoadPLY(const size_t num_vertices) {
+    std::vector<float> positions(3 * num_vertices);
+    std::vector<uint8_t> colors(4 * num_vertices);
+    std::vector<uint16_t> labels(num_vertices);
+    std::vector<int32_t> faces(6 * num_vertices);
+    for (size_t i = 0; i < positions.size(); i++)
+        positions[i] = 0.001f * (i % 4099);
+    for (size_t i = 0; i < colors.size(); i++)
+        colors[i] = i % 251;
+    for (size_t i = 0; i < labels.size(); i++)
+        labels[i] = i % 40;
+    for (size_t i = 0; i < faces.size(); i++)
+        faces[i] = (i * 7919) % num_vertices;
+    
+    const std::string file_name = "classy_voxelizer_bench_mesh.ply";
+    std::filebuf fb;
+    fb.open(file_name, std::ios::out | std::ios::binary);
+    std::ostream os(&fb);
+    tinyply::PlyFile out_file;
+    out_file.add_properties_to_element("vertex", { "x", "y", "z" }, positions);
+    out_file.add_properties_to_element("vertex", { "red", "green", "blue", "alpha" }, colors);
+    out_file.add_properties_to_element("vertex", { "label" }, labels);
+    out_file.add_properties_to_element("face", { "vertex_indices" }, faces, 3, tinyply::PlyProperty::Type::UINT8);
+    out_file.write(os, true);
+    fb.close();
+    
+    std::ifstream size_check(file_name, std::ios::binary | std::ios::ate);
+    const double megabytes = size_check.tellg() / 1e6;
+    const double seconds = TimeBest(3, [&]() {
+        std::ifstream is(file_name, std::ios::binary);
+        tinyply::PlyFile in_file(is);
+        std::vector<float> in_positions;
+        std::vector<uint8_t> in_colors;
+        std::vector<uint16_t> in_labels;
+        std::vector<uint32_t> in_faces;
+        in_file.request_properties_from_element("vertex", { "x", "y", "z" }, in_positions);
+        in_file.request_properties_from_element("vertex", { "red", "green", "blue" }, in_colors);
+        in_file.request_properties_from_element("vertex", { "label" }, in_labels);
+        in_file.request_properties_from_element("face", { "vertex_indices" }, in_faces, 3);
+        in_file.read(is);
+    });
+    std::remove(file_name.c_str());
+    std::cout << "load PLY " << num_vertices << " vertices, " << megabytes << " MB: " << seconds << " s, "
+              << megabytes / seconds << " MB/s" << std::endl;
+}
+
+// Face splitting alone, without stamping: every face is split down to its
+// leaves, which are only counted
+class SplitKernel: public Voxelizer {
+public:
+    uint64_t Split(const VoxelGridInterface& voxel_grid,
+                   const std::vector<Eigen::Vector3f>& vertices,
+                   const std::vector<uint32_t>& faces) const {
+        ScratchArray<Eigen::Vector3f> scratch_vertices(vertices);
+        std::vector<SplitTask> stack;
+        uint64_t num_sub_faces = 0;
+        for (size_t i = 0; i < faces.size(); i+=3) {
+            const Face face = {{ faces[i], faces[i+1], faces[i+2] }};
+            SubdivideFace(voxel_grid, scratch_vertices, face, stack,
+                          [](const Face&, const int) {},
+                          [&](const Face&) { num_sub_faces++; },
+                          [&]() { scratch_vertices.pop_back(); });
+        }
+        return num_sub_faces;
+    }
+};
+
+// throughput of one kernel of the suite. voxel_size is 0 for kernels that
+// don't depend on it
+struct KernelResult {
+    std::string kernel;
+    std::string mesh;
+    float voxel_size;
+    double throughput;
+    std::string unit;
+    
+    std::string GetKey() const {
+        std::ostringstream key;
+        key << kernel << "," << mesh << "," << voxel_size;
+        return key.str();
+    }
+};
+
+static uint64_t GetFileSize(const std::string& file_name) {
+    std::ifstream file(file_name, std::ios::binary | std::ios::ate);
+    return file ? static_cast<uint64_t>(file.tellg()) : 0;
+}
+
+static void PrintResult(const KernelResult& result, const std::string& detail) {
+    std::cout << std::left << std::setw(8) << result.mesh << std::setw(6) << result.voxel_size
+              << std::setw(16) << result.kernel << std::right << std::setw(10) << std::fixed << std::setprecision(2)
+              << result.throughput << " " << std::left << std::setw(11) << result.unit << std::defaultfloat
+              << detail << std::endl;
+}
+
+// ReadPly through ClassyVoxelizer, timed by its read stage. The scene is
+// voxelized too, at a voxel size coarse enough not to matter
+static void BenchmarkReadPLY(const SyntheticMesh& mesh, const int num_runs, std::vector<KernelResult>& results) {
+    const std::string file_name = "classy_voxelizer_bench_" + mesh.name + ".ply";
+    const std::string output_name = "classy_voxelizer_bench_out.ply";
+    mesh.SaveAsPLY(file_name);
+    ClassyVoxelizer classy_voxelizer(0.5f);
+    double seconds = 1e30;
+    for (int run = 0; run < num_runs; run++) {
+        const SceneStats stats = classy_voxelizer.Process(VoxelType::label, file_name, output_name, "");
+        seconds = std::min(seconds, stats.stages.GetWallSeconds("read"));
+    }
+    const double megabytes = GetFileSize(file_name) / 1e6;
+    std::remove(file_name.c_str());
+    std::remove(output_name.c_str());
+    results.push_back({ "read_ply", mesh.name, 0, megabytes / seconds, "MB/s" });
+    std::ostringstream detail;
+    detail << megabytes << " MB, " << mesh.faces.size() / 3 / seconds / 1e6 << " Mfaces/s";
+    PrintResult(results.back(), detail.str());
+}
+
+// kernels that depend on the voxel size, on grids padded by one voxel
+static void BenchmarkMeshKernels(const SyntheticMesh& mesh,
+                                 const float voxel_size,
+                                 const int num_runs,
+                                 std::vector<KernelResult>& results) {
+    const Eigen::Vector3f padding = Eigen::Vector3f::Constant(voxel_size);
+    const Eigen::Vector3f grid_min = mesh.GetMin() - padding;
+    const Eigen::Vector3f grid_max = mesh.GetMax() + padding;
+    const double num_faces = mesh.faces.size() / 3;
+    std::vector<Eigen::Vector3f> vertices = mesh.vertices;
+    std::vector<uint32_t> faces = mesh.faces;
+    std::vector<uint16_t> classes = mesh.classes;
+    std::vector<Eigen::Vector3i> colors = mesh.colors;
+    
+    MultiClassVoxelGrid class_grid(grid_min, grid_max, voxel_size);
+    class_grid.class_color_mapping.resize(1 + *std::max_element(classes.begin(), classes.end()), Eigen::Vector3i(10, 20, 30));
+    
+    // points spread over the faces, as the midpoints splitting creates
+    std::vector<Eigen::Vector3f> points;
+    uint64_t state = 11;
+    for (size_t i = 0; i < (1 << 20); i++) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        const size_t face_i = 3 * ((state >> 33) % static_cast<uint64_t>(num_faces));
+        const float a = (state & 0xFFFF) / 65536.0f;
+        const float b = (1 - a) * ((state >> 16) & 0xFFFF) / 65536.0f;
+        points.push_back(a * vertices[faces[face_i]] + b * vertices[faces[face_i+1]] + (1 - a - b) * vertices[faces[face_i+2]]);
+    }
+    VoxelID checksum = 0;
+    const double voxel_id_seconds = TimeBest(num_runs, [&]() {
+        for (const auto& point: points)
+            checksum += class_grid.GetEnclosingVoxelID(point);
+    });
+    results.push_back({ "voxel_id", mesh.name, voxel_size, points.size() / voxel_id_seconds / 1e6, "Mpoints/s" });
+    PrintResult(results.back(), "(checksum " + std::to_string(checksum % 1000) + ")");
+    
+    // the same points in one batch on every instruction set the CPU has,
+    // checked against the per-point ids
+    std::vector<VoxelID> expected_voxel_ids;
+    for (const auto& point: points)
+        expected_voxel_ids.push_back(class_grid.GetEnclosingVoxelID(point));
+    const std::pair<SimdLevel, std::string> simd_levels[] = {
+        { SimdLevel::scalar, "scalar" }, { SimdLevel::sse2, "sse2" }, { SimdLevel::avx2, "avx2" }
+    };
+    std::vector<VoxelID> voxel_ids(points.size());
+    for (const auto& simd_level: simd_levels) {
+        if (simd_level.first > VoxelGridInterface::GetSupportedSimdLevel())
+            break;
+        const double batch_seconds = TimeBest(num_runs, [&]() {
+            class_grid.GetEnclosingVoxelIDs(points.data(), points.size(), voxel_ids.data(), simd_level.first);
+        });
+        results.push_back({ "voxel_ids_" + simd_level.second, mesh.name, voxel_size, points.size() / batch_seconds / 1e6, "Mpoints/s" });
+        PrintResult(results.back(), (voxel_ids == expected_voxel_ids) ? "batched" : "batched, MISMATCH with voxel_id");
+    }
+    
+    SplitKernel split_kernel;
+    uint64_t num_sub_faces = 0;
+    const double split_seconds = TimeBest(num_runs, [&]() { num_sub_faces = split_kernel.Split(class_grid, vertices, faces); });
+    results.push_back({ "split", mesh.name, voxel_size, num_faces / split_seconds / 1e3, "kfaces/s" });
+    std::ostringstream split_detail;
+    split_detail << num_sub_faces << " sub-faces, " << num_sub_faces / split_seconds / 1e6 << " Msub-faces/s";
+    PrintResult(results.back(), split_detail.str());
+    
+    MultiClassVoxelizer class_voxelizer;
+    const double class_seconds = TimeBest(num_runs, [&]() { class_voxelizer.Voxelize(class_grid, vertices, faces, classes); });
+    MultiClassVoxelGrid raster_grid(grid_min, grid_max, voxel_size);
+    MultiClassVoxelizer raster_voxelizer;
+    raster_voxelizer.SetMethod(VoxelizationMethod::raster);
+    const double raster_seconds = TimeBest(num_runs, [&]() { raster_voxelizer.Voxelize(raster_grid, vertices, faces, classes); });
+    const uint64_t num_occupied = class_grid.GetNumOccupied();
+    results.push_back({ "voxelize_class", mesh.name, voxel_size, num_faces / class_seconds / 1e3, "kfaces/s" });
+    PrintResult(results.back(), std::to_string(num_occupied) + " voxels");
+    results.push_back({ "raster", mesh.name, voxel_size, num_faces / raster_seconds / 1e3, "kfaces/s" });
+    PrintResult(results.back(), std::to_string(raster_grid.GetNumOccupied()) + " voxels");
+    
+    {
+        ColoredVoxelGrid color_grid(grid_min, grid_max, voxel_size);
+        ColoredVoxelizer color_voxelizer;
+        const double color_seconds = TimeBest(num_runs, [&]() { color_voxelizer.Voxelize(color_grid, vertices, faces, colors); });
+        results.push_back({ "voxelize_color", mesh.name, voxel_size, num_faces / color_seconds / 1e3, "kfaces/s" });
+        PrintResult(results.back(), std::to_string(color_grid.GetNumOccupied()) + " voxels");
+    }
+    
+    // the export loop alone, without formatting or writing a file
+    VoxelArrays voxels;
+    const double occupied_seconds = TimeBest(num_runs, [&]() { class_grid.GetOccupiedVoxels(voxels); });
+    results.push_back({ "occupied_voxels", mesh.name, voxel_size, voxels.size() / occupied_seconds / 1e6, "Mvoxels/s" });
+    PrintResult(results.back(), "GetOccupiedVoxels");
+    
+    const std::string file_name = "classy_voxelizer_bench.ply";
+    const double save_seconds = TimeBest(num_runs, [&]() { class_grid.SaveAsPLY(file_name); });
+    results.push_back({ "save_ply", mesh.name, voxel_size, GetFileSize(file_name) / 1e6 / save_seconds, "MB/s" });
+    std::ostringstream save_detail;
+    save_detail << num_occupied / save_seconds / 1e6 << " Mvoxels/s";
+    PrintResult(results.back(), save_detail.str());
+    
+    // the same voxels as runs, and both read back into arrays
+    const std::string voxel_file_name = "classy_voxelizer_bench.cvox";
+    const double ply_megabytes = GetFileSize(file_name) / 1e6;
+    const double cvox_save_seconds = TimeBest(num_runs, [&]() { class_grid.SaveAsVoxelFile(voxel_file_name); });
+    const double cvox_megabytes = GetFileSize(voxel_file_name) / 1e6;
+    results.push_back({ "save_cvox", mesh.name, voxel_size, num_occupied / cvox_save_seconds / 1e6, "Mvoxels/s" });
+    std::ostringstream cvox_save_detail;
+    cvox_save_detail << cvox_megabytes << " MB, " << ply_megabytes / cvox_megabytes << "x smaller than PLY";
+    PrintResult(results.back(), cvox_save_detail.str());
+    std::vector<float> ply_positions;
+    const double ply_load_seconds = TimeBest(num_runs, [&]() {
+        std::ifstream is(file_name, std::ios::binary);
+        tinyply::PlyFile in_file(is);
+        std::vector<uint8_t> ply_colors;
+        std::vector<int32_t> ply_labels;
+        in_file.request_properties_from_element("vertex", { "x", "y", "z" }, ply_positions);
+        in_file.request_properties_from_element("vertex", { "red", "green", "blue" }, ply_colors);
+        in_file.request_properties_from_element("vertex", { "label" }, ply_labels);
+        in_file.read(is);
+    });
+    results.push_back({ "load_voxel_ply", mesh.name, voxel_size, ply_positions.size() / 3 / ply_load_seconds / 1e6, "Mvoxels/s" });
+    PrintResult(results.back(), "tinyply");
+    VoxelArrays read_voxels;
+    const double cvox_load_seconds = TimeBest(num_runs, [&]() { ReadVoxelFile(voxel_file_name, read_voxels); });
+    const bool identical = read_voxels.coordinates == voxels.coordinates && read_voxels.colors == voxels.colors &&
+                           read_voxels.classes == voxels.classes;
+    results.push_back({ "load_cvox", mesh.name, voxel_size, read_voxels.size() / cvox_load_seconds / 1e6, "Mvoxels/s" });
+    PrintResult(results.back(), identical ? "ReadVoxelFile" : "ReadVoxelFile, MISMATCH with GetOccupiedVoxels");
+    std::remove(voxel_file_name.c_str());
+    const double mesh_seconds = TimeBest(num_runs, [&]() {
+        class_grid.SaveAsPLYMesh(file_name, PlyFormat::binary, MeshStyle::surface);
+    });
+    results.push_back({ "save_mesh", mesh.name, voxel_size, GetFileSize(file_name) / 1e6 / mesh_seconds, "MB/s" });
+    std::ostringstream mesh_detail;
+    mesh_detail << num_occupied / mesh_seconds / 1e6 << " Mvoxels/s, surface style";
+    PrintResult(results.back(), mesh_detail.str());
+    std::remove(file_name.c_str());
+}
+
+// Per-kernel throughput on synthetic meshes: a tilted plane, a sphere, long
+// thin slivers and a ScanNet-like room, each at every voxel size
+static std::vector<KernelResult> RunSuite(const std::vector<float>& voxel_sizes, const int num_runs) {
+    std::vector<SyntheticMesh> meshes;
+    meshes.push_back(CreatePlane(3, 0.02f));
+    meshes.push_back(CreateSphere(1, 6));
+    meshes.push_back(CreateSlivers(2000, 1.5f, 0.002f));
+    meshes.push_back(CreateRoom(Eigen::Vector3f(4, 3.5f, 2.6f), 12, 0.04f));
+    std::vector<KernelResult> results;
+    for (const auto& mesh: meshes) {
+        std::cout << mesh.name << ": " << mesh.vertices.size() << " vertices, " << mesh.faces.size() / 3 << " faces" << std::endl;
+        BenchmarkReadPLY(mesh, num_runs, results);
+        for (const auto& voxel_size: voxel_sizes)
+            BenchmarkMeshKernels(mesh, voxel_size, num_runs, results);
+    }
+    return results;
+}
+
+static bool SaveBaseline(const std::string& file_name, const std::vector<KernelResult>& results) {
+    std::ofstream baseline(file_name);
+    if (!baseline) {
+        std::cerr << "Error: cannot write " << file_name << std::endl;
+        return false;
+    }
+    baseline << "kernel,mesh,voxel_size,throughput,unit" << std::endl;
+    for (const auto& result: results)
+        baseline << result.GetKey() << "," << result.throughput << "," << result.unit << std::endl;
+    return true;
+}
+
+// Returns false if the baseline cannot be read or a kernel's throughput
+// dropped by more than threshold (a fraction) below its baseline
+static bool CompareWithBaseline(const std::string& file_name,
+                                const std::vector<KernelResult>& results,
+                                const double threshold) {
+    std::ifstream baseline(file_name);
+    if (!baseline) {
+        std::cerr << "Error: cannot read " << file_name << std::endl;
+        return false;
+    }
+    std::map<std::string, double> baseline_throughputs;
+    std::string line;
+    std::getline(baseline, line);
+    while (std::getline(baseline, line)) {
+        // key is the first three fields
+        size_t comma = 0;
+        for (int field = 0; field < 3 && comma != std::string::npos; field++)
+            comma = line.find(',', comma + (field > 0));
+        if (comma == std::string::npos)
+            continue;
+        baseline_throughputs[line.substr(0, comma)] = std::stod(line.substr(comma + 1));
+    }
+    
+    std::cout << std::endl << "Compared with " << file_name << ", threshold " << 100 * threshold << "%:" << std::endl;
+    int num_regressions = 0;
+    for (const auto& result: results) {
+        const auto found = baseline_throughputs.find(result.GetKey());
+        if (found == baseline_throughputs.end()) {
+            PrintResult(result, "not in baseline");
+            continue;
+        }
+        const double change = result.throughput / found->second - 1;
+        const bool regressed = (change < -threshold);
+        num_regressions += regressed;
+        std::ostringstream detail;
+        detail << std::showpos << std::fixed << std::setprecision(1) << 100 * change << "%"
+               << (regressed ? "  REGRESSION" : "");
+        PrintResult(result, detail.str());
+    }
+    std::cout << num_regressions << " of " << results.size() << " kernels regressed" << std::endl;
+    return num_regressions == 0;
+}
+
+int main(int argc, char* argv[]) {
+    int size = 512;
+    bool suite = false;
+    int num_runs = 3;
+    std::vector<float> voxel_sizes = { 0.05f, 0.02f, 0.01f };
+    std::string save_baseline;
+    std::string baseline;
+    double threshold = 0.15;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg(argv[i]);
+        if (arg == "--suite")
+            suite = true;
+        else if (arg == "--runs" && i + 1 < argc)
+            num_runs = std::stoi(argv[++i]);
+        else if (arg == "--voxel-sizes" && i + 1 < argc) {
+            voxel_sizes.clear();
+            std::istringstream voxel_size_list(argv[++i]);
+            for (std::string voxel_size; std::getline(voxel_size_list, voxel_size, ',');)
+                voxel_sizes.push_back(std::stof(voxel_size));
+        }
+        else if (arg == "--save-baseline" && i + 1 < argc)
+            save_baseline = argv[++i];
+        else if (arg == "--baseline" && i + 1 < argc)
+            baseline = argv[++i];
+        else if (arg == "--threshold" && i + 1 < argc)
+            threshold = std::stod(argv[++i]);
+        else
+            size = std::stoi(arg);
+    }
+    if (suite || !save_baseline.empty() || !baseline.empty()) {
+        if (!baseline.empty() && !std::ifstream(baseline)) {
+            std::cerr << "Error: cannot read " << baseline << std::endl;
+            return 1;
+        }
+        const std::vector<KernelResult> results = RunSuite(voxel_sizes, num_runs);
+        if (!save_baseline.empty() && !SaveBaseline(save_baseline, results))
+            return 1;
+        if (!baseline.empty() && !CompareWithBaseline(baseline, results, threshold))
+            return 1;
+        return 0;
+    }
+    BenchmarkColorGrid(size);
+    BenchmarkTraversal(size);
+    BenchmarkSaveAsPLY(size, VoxelStorage::dense);
+    BenchmarkSaveAsPLY(size, VoxelStorage::sparse);
+    BenchmarkLoadPLY(size * size * 8);
+    BenchmarkConcurrentWrites(size / 2);
+    BenchmarkSplit(1);
+    BenchmarkSplit(4);
+    return 0;
+}
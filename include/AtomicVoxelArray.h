@@ -0,0 +1,83 @@
+/*
+ Classy Voxelizer
+
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#ifndef __ATOMICVOXELARRAY__
+#define __ATOMICVOXELARRAY__
+
+#include <atomic>
+#include <memory>
+
+#include "VoxelArray.h"
+
+// Dense per-voxel words that several threads can update at once without
+// locks. A word of zero is an empty voxel. What the other words mean is up to
+// the grid, which therefore also reports when a voxel changes between empty
+// and occupied, to keep the running count of occupied voxels.
+template <typename Word>
+class AtomicVoxelArray {
+public:
+    // empties the array for a grid of num_voxels, keeping the allocation if
+    // the size doesn't change. Not safe against concurrent updates
+    void Reset(const VoxelID num_voxels) {
+        if (num_voxels != num_voxels_) {
+            words_.reset(num_voxels ? new std::atomic<Word>[num_voxels] : nullptr);
+            num_voxels_ = num_voxels;
+        }
+        for (VoxelID i = 0; i < num_voxels_; i++)
+            words_[i].store(0, std::memory_order_relaxed);
+        num_occupied_.store(0, std::memory_order_relaxed);
+    }
+
+    Word Get(const VoxelID voxel_id) const {
+        return words_[voxel_id].load(std::memory_order_relaxed);
+    }
+
+    VoxelID GetNumOccupied() const {
+        return num_occupied_.load(std::memory_order_relaxed);
+    }
+
+    // all return the word before the update
+    Word Exchange(const VoxelID voxel_id, const Word word) {
+        return words_[voxel_id].exchange(word, std::memory_order_relaxed);
+    }
+
+    Word FetchAdd(const VoxelID voxel_id, const Word delta) {
+        return words_[voxel_id].fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    // replaces the word by update(word), retrying if another thread got in
+    // between. update has to be a pure function of the word
+    template <typename Function>
+    Word Update(const VoxelID voxel_id, const Function& update) {
+        Word word = words_[voxel_id].load(std::memory_order_relaxed);
+        while (!words_[voxel_id].compare_exchange_weak(word, update(word), std::memory_order_relaxed)) {}
+        return word;
+    }
+
+    void CountOccupied(const bool was_occupied, const bool is_occupied) {
+        if (was_occupied != is_occupied)
+            num_occupied_.fetch_add(is_occupied ? 1 : -1, std::memory_order_relaxed);
+    }
+
+    // in order of voxel id, skipping zero words
+    template <typename Function>
+    void ForEachNonZero(const Function& function) const {
+        for (VoxelID voxel_id = 0; voxel_id < num_voxels_; voxel_id++) {
+            const Word word = Get(voxel_id);
+            if (word != 0)
+                function(voxel_id, word);
+        }
+    }
+
+private:
+    std::unique_ptr<std::atomic<Word>[]> words_;
+    VoxelID num_voxels_ = 0;
+    std::atomic<VoxelID> num_occupied_{0};
+};
+
+#endif /* defined(__ATOMICVOXELARRAY__) */
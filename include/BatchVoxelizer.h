@@ -0,0 +1,59 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#ifndef __BATCHVOXELIZER__
+#define __BATCHVOXELIZER__
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ClassyVoxelizer.h"
+
+// Voxelizes many scenes in one process on a number of concurrent workers.
+// Every worker owns one ClassyVoxelizer, so input buffers and the voxel grid
+// are reused from one scene to the next.
+class BatchVoxelizer {
+public:
+    typedef std::function<std::unique_ptr<ClassyVoxelizer>()> VoxelizerFactory;
+    BatchVoxelizer(const VoxelizerFactory& create_voxelizer, const int num_jobs);
+    // input: a directory searched recursively for .ply files, or a manifest
+    // with one input file per line. Empty lines and lines starting with '#'
+    // are skipped, relative paths are relative to the manifest
+    bool CollectInputs(const std::string& input);
+    // writes <output_dir>/<input file name> per scene (suffixed with the voxel
+    // size if the voxelizers produce several resolutions, and ending in .cvox
+    // for voxel files), optionally <mesh_output_dir>/<input file stem>_mesh.ply,
+    // and a per-scene summary to <output_dir>/summary.csv. If report_file is
+    // set, the stats and stage timings of every scene are also written there as
+    // a JSON array. output_format must be the one the voxelizers write
+    bool Process(const VoxelType voxel_type,
+                 const std::string& output_dir,
+                 const std::string& mesh_output_dir,
+                 const std::string& report_file = "",
+                 const VoxelFormat output_format = VoxelFormat::ply);
+private:
+    struct SceneResult {
+        SceneStats stats;
+        uint64_t output_bytes = 0;
+        double seconds = 0;
+        std::string error;
+    };
+    const VoxelizerFactory create_voxelizer_;
+    const int num_jobs_;
+    std::vector<std::string> input_files_;
+    
+    void CollectDirectory(const std::string& directory);
+    bool WriteSummary(const std::string& filepath,
+                      const std::vector<std::string>& output_files,
+                      const std::vector<SceneResult>& results) const;
+    bool WriteReport(const std::string& filepath, const std::vector<SceneResult>& results) const;
+};
+
+#endif /* defined(__BATCHVOXELIZER__) */
@@ -0,0 +1,55 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#ifndef __BUFFEREDFILEWRITER__
+#define __BUFFEREDFILEWRITER__
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Streams output to a file through a fixed-size buffer, so large exports never
+// hold more than the buffer in memory. Flushed and closed on destruction, or by
+// Close, which also tells whether all of the output made it to the file.
+class BufferedFileWriter {
+public:
+    BufferedFileWriter(const std::string& filepath, const size_t buffer_size = 1 << 20);
+    ~BufferedFileWriter();
+    bool IsOpen() const;
+    // false once output was lost, e.g. to a full disk
+    bool IsGood() const;
+    void Write(const void* data, const size_t size);
+    // binary PLY is written little-endian regardless of the host
+    template <typename T>
+    void WriteLittleEndian(const T& value) {
+        char bytes[sizeof(T)];
+        memcpy(bytes, &value, sizeof(T));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        for (size_t i = 0; i < sizeof(T) / 2; i++)
+            std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+#endif
+        Write(bytes, sizeof(T));
+    }
+    // printf-style formatted text
+    void Print(const char* format, ...);
+    void Flush();
+    // flushes and continues writing at the start of the file, over what is
+    // already there, e.g. to patch a header once its counts are known
+    void Rewind();
+    // flushes and closes the file, false if any of the output was lost
+    bool Close();
+private:
+    std::FILE* file_ = nullptr;
+    bool failed_ = false;
+    std::vector<char> buffer_;
+    size_t size_ = 0;
+};
+
+#endif /* defined(__BUFFEREDFILEWRITER__) */
@@ -10,22 +10,112 @@
 #define __CLASSYVOXELIZER__
 
 #include <Eigen/Dense>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "tinyply.h"
+#include "StageReport.h"
+#include "VoxelArray.h"
+#include "VoxelGrid.h"
+#include "Voxelizer.h"
+
 enum class VoxelType {
     color, label
 };
 
+// ply: point cloud of the voxel centers, cvox: runs of voxels, see VoxelFile.h
+enum class VoxelFormat {
+    ply, cvox
+};
+
+// mesh held in memory by the caller, laid out like the PLY input: x, y, z of
+// num_vertices positions, vertex indices of num_faces triangles and,
+// optionally, a label and a red, green, blue color per vertex. Without
+// labels, class mode takes the classes from the colors
+struct MeshView {
+    const float* positions = nullptr;
+    size_t num_vertices = 0;
+    const uint32_t* faces = nullptr;
+    size_t num_faces = 0;
+    const uint16_t* labels = nullptr;
+    const uint8_t* colors = nullptr;
+};
+
+class MultiClassVoxelGrid;
+class ColoredVoxelGrid;
+
+// size of one processed scene, num_faces is 0 if the input could not be used.
+// num_occupied_voxels is the count of the finest grid
+struct SceneStats {
+    size_t num_vertices = 0;
+    size_t num_faces = 0;
+    uint64_t num_occupied_voxels = 0;
+    std::vector<std::string> output_files;
+    // false if an output or voxel mesh could not be written completely
+    bool outputs_written = true;
+    // read, prepare, allocate, voxelize, save and save_mesh (or extract) as far
+    // as reached
+    StageReport stages;
+};
+
 class ClassyVoxelizer {
 public:
     ClassyVoxelizer(const float voxel_size);
-    void Process(const VoxelType voxel_type,
-                 const std::string& input_file,
-                 const std::string& output_file,
-                 const std::string& mesh_output);
+    // one output per voxel size from a single load and subdivision pass,
+    // outputs are named <output>_<voxel_size>.ply (or .cvox) if there is more
+    // than one
+    ClassyVoxelizer(const std::vector<float>& voxel_sizes);
+    ~ClassyVoxelizer();
+    void SetNumThreads(const int num_threads);
+    void SetMethod(const VoxelizationMethod method);
+    void SetStorage(const VoxelStorage storage);
+    void SetOutputFormat(const VoxelFormat output_format);
+    void SetMeshFormat(const PlyFormat mesh_format);
+    void SetMeshStyle(const MeshStyle mesh_style);
+    void SetMappedInput(const bool mapped_input);
+    void SetAggregation(const VoxelAggregation aggregation);
+    // progress to stdout, off by default. Errors always go to stderr
+    void SetVerbose(const bool verbose);
+    // out-of-core mode for scenes whose grid does not fit in memory: space is
+    // tiled into cubes of chunk_size voxels of the finest grid, voxelized one
+    // after another and streamed to the outputs. 0 voxelizes in one piece
+    void SetChunkSize(const int chunk_size);
+    // out-of-core mode sized to memory: the chunk size is chosen so that the
+    // grids of the fullest chunk are estimated to stay within memory_budget_mb,
+    // from the area of its faces. An explicit chunk size takes precedence
+    void SetMemoryBudget(const int memory_budget_mb);
+    // input buffers and the voxel grid are kept for the next call
+    SceneStats Process(const VoxelType voxel_type,
+                       const std::string& input_file,
+                       const std::string& output_file,
+                       const std::string& mesh_output);
+    // Process without any file I/O: the mesh is copied in, and voxels[i]
+    // receives the occupied voxels at the i-th voxel size, in ascending order.
+    // Always voxelizes in one piece, the chunk size only applies to Process
+    SceneStats Voxelize(const VoxelType voxel_type, const MeshView& mesh, std::vector<VoxelArrays>& voxels);
+    // stats of one scene as a JSON object, lines after the first indented by
+    // indent spaces
+    static void WriteReport(std::ostream& out,
+                            const std::string& input_file,
+                            const SceneStats& stats,
+                            const std::string& status = "ok",
+                            const int indent = 0);
 private:
-    const float voxel_size_ = 0;
+    std::vector<float> voxel_sizes_; // ascending
     const int num_labels_ = 1163; // ScanNet
+    int num_threads_ = 1;
+    VoxelizationMethod method_ = VoxelizationMethod::split;
+    VoxelStorage storage_ = VoxelStorage::dense;
+    VoxelFormat output_format_ = VoxelFormat::ply;
+    PlyFormat mesh_format_ = PlyFormat::binary;
+    MeshStyle mesh_style_ = MeshStyle::cubes;
+    bool mapped_input_ = true;
+    VoxelAggregation aggregation_ = VoxelAggregation::last;
+    bool verbose_ = false;
+    int chunk_size_ = 0;
+    int memory_budget_mb_ = 0;
     Eigen::Vector3f min_;
     Eigen::Vector3f max_;
     
@@ -35,14 +125,53 @@ private:
     std::vector<uint16_t> vertex_labels_;
     std::vector<Eigen::Vector3i> colormap_;
     std::vector<Eigen::Vector3i> colors_;
+    std::vector<std::unique_ptr<MultiClassVoxelGrid>> class_grids_;
+    std::vector<std::unique_ptr<ColoredVoxelGrid>> color_grids_;
 
     bool SaveVoxelizedMesh(const std::string& file_name) const;
+    void ClearMesh();
+    // false if a face index is out of range
+    bool LoadMesh(const MeshView& mesh);
+    // everything after loading the mesh. Writes stats.output_files and
+    // mesh_output, or fills voxels if it is set
+    void VoxelizeMesh(const VoxelType voxel_type,
+                      const std::string& mesh_output,
+                      std::vector<VoxelArrays>* voxels,
+                      SceneStats& stats);
+    // point clouds or voxel files, then meshes if mesh_output is set, each
+    // timed as a stage. Extracts the voxels instead if voxels is set
+    template <typename Grid>
+    void OutputGrids(const std::vector<Grid*>& voxel_grids,
+                     const std::string& mesh_output,
+                     std::vector<VoxelArrays>* voxels,
+                     SceneStats& stats) const;
+    static void AddVoxelizeCounts(StageReport& stages, const VoxelizeStats& stats, const uint64_t num_occupied);
+    // returns the number of voxels written for the finest grid
+    template <typename Grid, typename GridVoxelizer, typename Attribute>
+    uint64_t VoxelizeInChunks(GridVoxelizer& voxelizer,
+                              const std::vector<Grid*>& voxel_grids,
+                              const std::vector<Attribute>& vertex_attributes,
+                              SceneStats& stats);
+    // calls function with every chunk the bounds of face face_i overlap,
+    // grown by the coarsest voxel size
+    void ForEachFaceChunk(const size_t face_i,
+                          const float chunk_extent,
+                          const Eigen::Vector3i& num_chunks,
+                          const std::function<void(const size_t chunk_i)>& function) const;
+    Eigen::Vector3i GetNumChunks(const float chunk_extent) const;
+    // largest chunk size, in voxels of the finest grid, whose fullest chunk fits
+    // memory_budget_mb_
+    int GetBudgetChunkSize() const;
     int ReadPly(const std::string& filepath);
+    uint32_t RequestPlyProperties(tinyply::PlyFile& input_file, std::vector<uint8_t>& raw_colors);
+    int StorePlyProperties(const uint32_t num_vertices, const std::vector<uint8_t>& raw_colors);
     bool CreateColorMap(const std::vector<Eigen::Vector3i>& colors,
-                        std::vector<Eigen::Vector3i>& colormap);
+                        std::vector<Eigen::Vector3i>& colormap,
+                        std::unordered_map<uint32_t, uint16_t>& color_classes);
     bool ComputeColorFromLabel(std::vector<uint16_t>& labels, const int num_labels);
     bool ComputeClassFromColor(std::vector<uint16_t>& classes);
-    void GetVoxelSpaceDimensions(const double voxel_size);
+    void GetVoxelSpaceDimensions();
+    std::string GetOutputPath(const std::string& filepath, const float voxel_size) const;
 };
 
 #endif /* defined(__MULTICLASSVOXELIZER__) */
@@ -13,24 +13,56 @@
 
 //Eigen
 #include <Eigen/Dense>
+#include "AtomicVoxelArray.h"
+#include "VoxelArray.h"
 #include "VoxelGrid.h"
 
 #include "tinyply.h"
 
-class ColoredVoxelGrid: public VoxelGridInterface {
+class ColoredVoxelGrid: public VoxelGrid<ColoredVoxelGrid> {
 public:
     ColoredVoxelGrid(const Eigen::Vector3f& grid_min,
                      const Eigen::Vector3f& grid_max,
-                     const float voxel_size);
+                     const float voxel_size,
+                     const VoxelStorage storage = VoxelStorage::dense);
+    // empties the grid for new bounds, reusing its storage
+    void Reset(const Eigen::Vector3f& grid_min, const Eigen::Vector3f& grid_max, const float voxel_size);
+    void SetAggregation(const VoxelAggregation aggregation);
     void SetVoxelColor(const Eigen::Vector3f& vertex, const Eigen::Vector3i& color);
+    void SetVoxelColor(const VoxelID voxel_id, const Eigen::Vector3i& color);
 private:
-    std::vector<Eigen::Vector3i> voxel_grid_;
+    // color sums and number of samples of a voxel, exact up to 2^24 samples
+    typedef Eigen::Matrix<uint32_t, 4, 1, Eigen::DontAlign> ColorSum;
+    
+    // packed colors, see PackColor in the .cpp, 0 is empty
+    VoxelArray<uint32_t> voxel_grid_;
+    // majority: running sums the voxel colors are the mean of, kept for
+    // stamped voxels only
+    VoxelArray<ColorSum> color_sums_;
+    // atomic storage, last: packed colors. majority: red and
+    // green sums in one word, blue sum and sample count in the other, so
+    // samples are added with two fetch-adds
+    AtomicVoxelArray<uint32_t> atomic_colors_;
+    AtomicVoxelArray<uint64_t> atomic_red_green_;
+    AtomicVoxelArray<uint64_t> atomic_blue_count_;
     const Eigen::Vector3i empty_voxel_;
-    void SetVoxelColor(const uint32_t voxel_id, const Eigen::Vector3i& color);
-    virtual bool IsVoxelOccupied(const uint32_t voxel_id) const override;
-    virtual const Eigen::Vector3i& GetVoxelColor(const uint32_t voxel_id) const override;
+    const std::vector<Eigen::Vector3i> no_class_colors_;
+    
+    void ResetAtomicStorage();
+    bool IsVoxelOccupied(const VoxelID voxel_id) const;
+    Eigen::Vector3i GetVoxelColor(const VoxelID voxel_id) const;
 
-    virtual unsigned int GetNumOccupiedVoxels() const override;
+    uint64_t GetNumOccupiedVoxels() const;
+    int GetVoxelClass(const VoxelID) const { return 0; }
+    const std::vector<Eigen::Vector3i>& GetClassColors() const { return no_class_colors_; }
+    // in the .cpp, only the exports instantiated there call it
+    template <typename Function>
+    void ForEachOccupiedVoxel(const Function& function) const;
+    
+    friend class VoxelGrid<ColoredVoxelGrid>;
 };
 
+// instantiated in ColoredVoxelGrid.cpp
+extern template class VoxelGrid<ColoredVoxelGrid>;
+
 #endif /* defined(__ColoredVOXELGRID__) */
@@ -24,15 +24,43 @@ class ColoredVoxelizer: public Voxelizer {
 public:
     ColoredVoxelizer() = default;
     void Voxelize(ColoredVoxelGrid& voxel_grid,
-                  std::vector<Eigen::Vector3f>& vertices,
-                  std::vector<uint32_t>& faces,
-                  std::vector<Eigen::Vector3i>& colors);
+                  const std::vector<Eigen::Vector3f>& vertices,
+                  const std::vector<uint32_t>& faces,
+                  const std::vector<Eigen::Vector3i>& colors);
+    // several resolutions from one subdivision pass, see MultiClassVoxelizer
+    void Voxelize(const std::vector<ColoredVoxelGrid*>& voxel_grids,
+                  const std::vector<Eigen::Vector3f>& vertices,
+                  const std::vector<uint32_t>& faces,
+                  const std::vector<Eigen::Vector3i>& colors);
 private:
-	void SplitFace(ColoredVoxelGrid& voxel_grid,
-                   std::vector<Eigen::Vector3f>& vertices,
-                   std::vector<Eigen::Vector3i>& colors,
-                   std::vector<uint32_t>& face,
-                   std::vector<uint32_t>& sub_faces);
+    // stamps leaf sub-faces as soon as they are produced, midpoints live on
+    // the scratch stack only while their sub-faces are being split
+    void SplitAndStampFace(const std::vector<ColoredVoxelGrid*>& voxel_grids,
+                           ScratchArray<Eigen::Vector3f>& vertices,
+                           ScratchArray<Eigen::Vector3i>& colors,
+                           const Face& face,
+                           std::vector<SplitTask>& stack,
+                           VoxelizeStats& stats);
+    void SplitFace(const ColoredVoxelGrid& voxel_grid,
+                   ScratchArray<Eigen::Vector3f>& vertices,
+                   ScratchArray<Eigen::Vector3i>& colors,
+                   const Face& face,
+                   std::vector<SplitTask>& stack,
+                   std::vector<uint32_t>& sub_faces) const;
+    void VoxelizeParallel(const std::vector<ColoredVoxelGrid*>& voxel_grids,
+                          const std::vector<Eigen::Vector3f>& vertices,
+                          const std::vector<uint32_t>& faces,
+                          const std::vector<Eigen::Vector3i>& colors);
+    // every worker splits and stamps its faces like the serial path, into
+    // grids that take concurrent writes
+    void VoxelizeConcurrent(const std::vector<ColoredVoxelGrid*>& voxel_grids,
+                            const std::vector<Eigen::Vector3f>& vertices,
+                            const std::vector<uint32_t>& faces,
+                            const std::vector<Eigen::Vector3i>& colors);
+    void VoxelizeRaster(ColoredVoxelGrid& voxel_grid,
+                        const std::vector<Eigen::Vector3f>& vertices,
+                        const std::vector<uint32_t>& faces,
+                        const std::vector<Eigen::Vector3i>& colors);
 };
 
 #endif /* defined(__ColoredVOXELIZER__) */
@@ -0,0 +1,34 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#ifndef __MAPPEDFILE__
+#define __MAPPEDFILE__
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file, unmapped on destruction. The
+// pages are read in by the kernel on first access and can be dropped again
+// without being written to swap.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filepath);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    bool IsOpen() const;
+    const char* GetData() const;
+    size_t GetSize() const;
+    // drops the pages before end from memory, they are read in again if accessed
+    void Release(const char* end) const;
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif /* defined(__MAPPEDFILE__) */
@@ -17,23 +17,46 @@
 
 //Eigen
 #include <Eigen/Dense>
+#include "AtomicVoxelArray.h"
+#include "VoxelArray.h"
 #include "VoxelGrid.h"
 
 #include "tinyply.h"
 
-class MultiClassVoxelGrid: public VoxelGridInterface {
+class MultiClassVoxelGrid: public VoxelGrid<MultiClassVoxelGrid> {
 public:
     MultiClassVoxelGrid(const Eigen::Vector3f& grid_min,
                         const Eigen::Vector3f& grid_max,
-                        float voxel_size);
-    void SetVoxelClass(const uint32_t voxel_id, const uint8_t class_i);
+                        float voxel_size,
+                        const VoxelStorage storage = VoxelStorage::dense);
+    // empties the grid for new bounds, reusing its storage
+    void Reset(const Eigen::Vector3f& grid_min, const Eigen::Vector3f& grid_max, const float voxel_size);
+    void SetAggregation(const VoxelAggregation aggregation);
+    void SetVoxelClass(const VoxelID voxel_id, const uint8_t class_i);
     std::vector<Eigen::Vector3i> class_color_mapping;
 private:
-    std::vector<uint8_t> voxel_grid_;
-    virtual bool IsVoxelOccupied(const uint32_t voxel_id) const override;
-    virtual int GetVoxelClass(const uint32_t voxel_id) const override;
-    virtual const Eigen::Vector3i& GetVoxelColor(const uint32_t voxel_id) const override;
-    virtual unsigned int GetNumOccupiedVoxels() const override;
+    // the class, with majority aggregation the majority of votes_
+    VoxelArray<uint8_t> voxel_grid_;
+    // majority: one packed top-k record of votes per voxel, see the .cpp
+    VoxelArray<uint64_t> votes_;
+    // atomic storage, last: the class, majority: the same votes as votes_
+    AtomicVoxelArray<uint8_t> atomic_classes_;
+    AtomicVoxelArray<uint64_t> atomic_votes_;
+    
+    void ResetAggregationStorage();
+    bool IsVoxelOccupied(const VoxelID voxel_id) const;
+    int GetVoxelClass(const VoxelID voxel_id) const;
+    Eigen::Vector3i GetVoxelColor(const VoxelID voxel_id) const;
+    const std::vector<Eigen::Vector3i>& GetClassColors() const { return class_color_mapping; }
+    uint64_t GetNumOccupiedVoxels() const;
+    // defined in the .cpp, for the exports instantiated there
+    template <typename Function>
+    void ForEachOccupiedVoxel(const Function& function) const;
+    
+    friend class VoxelGrid<MultiClassVoxelGrid>;
 };
 
+// instantiated in MultiClassVoxelGrid.cpp
+extern template class VoxelGrid<MultiClassVoxelGrid>;
+
 #endif /* defined(__MULTICLASSVOXELGRID__) */
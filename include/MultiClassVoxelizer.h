@@ -25,15 +25,58 @@ class MultiClassVoxelizer: public Voxelizer {
 public:
     MultiClassVoxelizer() = default;
     void Voxelize(MultiClassVoxelGrid& voxel_grid,
-                  std::vector<Eigen::Vector3f>& vertices,
-                  std::vector<uint32_t>& faces,
-                  std::vector<uint16_t>& vertex_classes);
+                  const std::vector<Eigen::Vector3f>& vertices,
+                  const std::vector<uint32_t>& faces,
+                  const std::vector<uint16_t>& vertex_classes);
+    // several resolutions from one subdivision pass: faces are split to the
+    // voxel size of the first, finest grid and every resulting vertex is
+    // stamped into all grids. Raster mode rasterizes each grid separately
+    void Voxelize(const std::vector<MultiClassVoxelGrid*>& voxel_grids,
+                  const std::vector<Eigen::Vector3f>& vertices,
+                  const std::vector<uint32_t>& faces,
+                  const std::vector<uint16_t>& vertex_classes);
+    // midpoints take the class of one end of the split edge or the other by
+    // the parity of a running midpoint count. The count runs over the whole
+    // scene, or restarts for every face with majority aggregation or when it
+    // is set here, so that voxelizing a subset of the faces, as out-of-core
+    // chunks do, gives the same midpoint classes
+    void SetPerFaceParity(const bool per_face_parity);
 private:
-    virtual void SplitFace(MultiClassVoxelGrid& voxel_grid,
-                   std::vector<Eigen::Vector3f>& vertices,
-                   std::vector<uint16_t>& vertex_classes,
-                   std::vector<uint32_t>& face,
-                   std::vector<uint32_t>& sub_faces);
+    bool per_face_parity_ = false;
+
+    // stamps leaf sub-faces as soon as they are produced, midpoints live on
+    // the scratch stack only while their sub-faces are being split.
+    // num_vertices counts every midpoint created so far, as if appended
+    void SplitAndStampFace(const std::vector<MultiClassVoxelGrid*>& voxel_grids,
+                           ScratchArray<Eigen::Vector3f>& vertices,
+                           ScratchArray<uint16_t>& vertex_classes,
+                           const Face& face,
+                           std::vector<SplitTask>& stack,
+                           size_t& num_vertices,
+                           VoxelizeStats& stats);
+    // worker variant: new midpoints stay thread-local and only their parent
+    // vertices are recorded, since the class a midpoint inherits depends on
+    // its index in the merged order of all midpoints
+    void SplitFace(const MultiClassVoxelGrid& voxel_grid,
+                   ScratchArray<Eigen::Vector3f>& vertices,
+                   std::vector<uint32_t>& midpoint_parents,
+                   const Face& face,
+                   std::vector<SplitTask>& stack,
+                   std::vector<uint32_t>& sub_faces) const;
+    void VoxelizeParallel(const std::vector<MultiClassVoxelGrid*>& voxel_grids,
+                          const std::vector<Eigen::Vector3f>& vertices,
+                          const std::vector<uint32_t>& faces,
+                          const std::vector<uint16_t>& vertex_classes);
+    // every worker splits and stamps its faces like the serial path, into
+    // grids that take concurrent writes
+    void VoxelizeConcurrent(const std::vector<MultiClassVoxelGrid*>& voxel_grids,
+                            const std::vector<Eigen::Vector3f>& vertices,
+                            const std::vector<uint32_t>& faces,
+                            const std::vector<uint16_t>& vertex_classes);
+    void VoxelizeRaster(MultiClassVoxelGrid& voxel_grid,
+                        const std::vector<Eigen::Vector3f>& vertices,
+                        const std::vector<uint32_t>& faces,
+                        const std::vector<uint16_t>& vertex_classes);
 };
 
 #endif /* defined(__MULTICLASSVOXELIZER__) */
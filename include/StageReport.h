@@ -0,0 +1,59 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#ifndef __STAGEREPORT__
+#define __STAGEREPORT__
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Wall time, CPU time, peak memory and counts of the stages of a run, written
+// out as JSON. A stage started again accumulates, e.g. once per chunk. CPU
+// time and peak memory are those of the whole process, so with concurrent
+// batch jobs they include the other jobs. Peak memory is the high-water mark
+// when the stage last stopped
+class StageReport {
+public:
+    // stops the running stage, if any
+    void Start(const std::string& stage);
+    void Stop();
+    // adds value to the count name of stage, creating both if needed
+    void AddCount(const std::string& stage, const std::string& name, const double value);
+    void Clear();
+    // 0 for stages that never ran
+    double GetWallSeconds(const std::string& stage) const;
+    // one object keyed by stage name, in order of first start. Lines after
+    // the first are indented by indent spaces
+    void WriteJSON(std::ostream& out, const int indent = 0) const;
+    
+    static size_t GetPeakMemoryUsage();
+    static double GetCPUSeconds();
+    // text as a JSON string, in quotes
+    static std::string Quote(const std::string& text);
+    // integral values without a fraction
+    static void WriteNumber(std::ostream& out, const double value);
+private:
+    struct Stage {
+        std::string name;
+        double wall_seconds = 0;
+        double cpu_seconds = 0;
+        size_t peak_rss_bytes = 0;
+        std::vector<std::pair<std::string, double>> counts;
+    };
+    std::vector<Stage> stages_;
+    int running_ = -1;
+    std::chrono::steady_clock::time_point wall_start_;
+    double cpu_start_ = 0;
+    
+    Stage& GetStage(const std::string& name);
+};
+
+#endif /* defined(__STAGEREPORT__) */
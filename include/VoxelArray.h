@@ -0,0 +1,157 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#ifndef __VOXELARRAY__
+#define __VOXELARRAY__
+
+#include <stdint.h>
+#include <vector>
+
+// linear voxel index x + X * y + X * Y * z, 64-bit so fine grids over large
+// scenes don't overflow
+typedef uint64_t VoxelID;
+
+// dense: one entry per voxel of the grid
+// sparse: open addressing hash table holding only the voxels written to
+// atomic: one lock-free word per voxel that several threads may write at
+//         once, see AtomicVoxelArray. Grids only, VoxelArray is never atomic
+enum class VoxelStorage {
+    dense, sparse, atomic
+};
+
+// Per-voxel values indexed by linear voxel id. Voxels never written read back
+// as the empty value, any other value marks the voxel occupied. Dense storage
+// keeps an occupancy bit per voxel so occupied voxels can be found a 64-bit
+// word at a time, both storages keep a running count of occupied voxels.
+template <typename T>
+class VoxelArray {
+public:
+    VoxelArray(const VoxelID num_voxels, const T& empty_value, const VoxelStorage storage):
+        storage_(storage), empty_value_(empty_value) {
+        if (storage_ == VoxelStorage::dense) {
+            values_.resize(num_voxels, empty_value_);
+            occupancy_.resize((num_voxels + 63) / 64, 0);
+        } else {
+            Rehash(kMinCapacity);
+        }
+    }
+
+    // empties the array for a grid of num_voxels, keeping the allocations
+    void Reset(const VoxelID num_voxels) {
+        if (storage_ == VoxelStorage::dense) {
+            values_.assign(num_voxels, empty_value_);
+            occupancy_.assign((num_voxels + 63) / 64, 0);
+        } else {
+            keys_.assign(keys_.size(), VoxelID(kEmptyKey));
+            values_.assign(values_.size(), empty_value_);
+            num_keys_ = 0;
+        }
+        num_occupied_ = 0;
+    }
+
+    bool IsSparse() const {
+        return storage_ == VoxelStorage::sparse;
+    }
+
+    const T& Get(const VoxelID voxel_id) const {
+        if (storage_ == VoxelStorage::dense)
+            return values_[voxel_id];
+        const size_t slot = FindSlot(voxel_id);
+        return (keys_[slot] == kEmptyKey) ? empty_value_ : values_[slot];
+    }
+
+    bool IsOccupied(const VoxelID voxel_id) const {
+        if (storage_ == VoxelStorage::dense)
+            return (occupancy_[voxel_id / 64] >> (voxel_id % 64)) & 1;
+        return !(Get(voxel_id) == empty_value_);
+    }
+
+    VoxelID GetNumOccupied() const {
+        return num_occupied_;
+    }
+
+    void Set(const VoxelID voxel_id, const T& value) {
+        const bool occupied = !(value == empty_value_);
+        if (storage_ == VoxelStorage::dense) {
+            const uint64_t bit = uint64_t(1) << (voxel_id % 64);
+            uint64_t& word = occupancy_[voxel_id / 64];
+            if (occupied != ((word & bit) != 0)) {
+                word ^= bit;
+                num_occupied_ += occupied ? 1 : -1;
+            }
+            values_[voxel_id] = value;
+            return;
+        }
+        size_t slot = FindSlot(voxel_id);
+        if (keys_[slot] == kEmptyKey) {
+            if (2 * (num_keys_ + 1) > keys_.size()) {
+                Rehash(2 * keys_.size());
+                slot = FindSlot(voxel_id);
+            }
+            keys_[slot] = voxel_id;
+            num_keys_++;
+        }
+        if (occupied != !(values_[slot] == empty_value_))
+            num_occupied_ += occupied ? 1 : -1;
+        values_[slot] = value;
+    }
+
+    // dense: in order of voxel id, sparse: in no particular order
+    template <typename Function>
+    void ForEachOccupied(const Function& function) const {
+        if (storage_ == VoxelStorage::dense) {
+            for (size_t word_i = 0; word_i < occupancy_.size(); word_i++) {
+                for (uint64_t word = occupancy_[word_i]; word != 0; word &= word - 1) {
+                    const VoxelID voxel_id = 64 * word_i + __builtin_ctzll(word);
+                    function(voxel_id, values_[voxel_id]);
+                }
+            }
+            return;
+        }
+        for (size_t i = 0; i < keys_.size(); i++) {
+            if (keys_[i] != kEmptyKey && !(values_[i] == empty_value_))
+                function(keys_[i], values_[i]);
+        }
+    }
+
+private:
+    static const VoxelID kEmptyKey = ~VoxelID(0);
+    static const size_t kMinCapacity = 1024;
+
+    const VoxelStorage storage_;
+    const T empty_value_;
+    std::vector<T> values_;
+    std::vector<VoxelID> keys_;
+    std::vector<uint64_t> occupancy_;
+    size_t num_keys_ = 0;
+    VoxelID num_occupied_ = 0;
+
+    size_t FindSlot(const VoxelID voxel_id) const {
+        const size_t mask = keys_.size() - 1;
+        size_t slot = static_cast<size_t>(((voxel_id ^ (voxel_id >> 32)) * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+        while (keys_[slot] != kEmptyKey && keys_[slot] != voxel_id)
+            slot = (slot + 1) & mask;
+        return slot;
+    }
+
+    void Rehash(const size_t capacity) {
+        std::vector<VoxelID> keys(capacity, VoxelID(kEmptyKey));
+        std::vector<T> values(capacity, empty_value_);
+        keys.swap(keys_);
+        values.swap(values_);
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keys[i] == kEmptyKey)
+                continue;
+            const size_t slot = FindSlot(keys[i]);
+            keys_[slot] = keys[i];
+            values_[slot] = values[i];
+        }
+    }
+};
+
+#endif /* defined(__VOXELARRAY__) */
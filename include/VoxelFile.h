@@ -0,0 +1,99 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#ifndef __VOXELFILE__
+#define __VOXELFILE__
+
+// Compact binary voxel format (.cvox), little-endian throughout:
+//
+//     char[4]       "CVOX"
+//     uint16        version, 1
+//     uint16        number of class colors n
+//     float         voxel size
+//     float[3]      grid min, the corner of voxel (0, 0, 0)
+//     int32[3]      voxels per dimension
+//     uint64        number of voxels
+//     uint8[3] * n  red, green, blue of every class, class grids only
+//
+// followed by runs of consecutive voxel ids, (z * voxels_y + y) * voxels_x + x:
+//
+//     varint        first id of the run minus the end of the previous run
+//                   (0 before the first run), zigzag-encoded
+//     varint        number of voxels in the run
+//     uint8         with class colors: the class of every voxel of the run
+//     uint8[3] * m  without: red, green, blue of each of the m voxels
+//
+// Varints hold 7 bits per byte, least significant first, with the high bit set
+// on all but the last byte. Class runs end where the class changes, color runs
+// only at empty voxels. Runs follow voxel id order, except in chunked output,
+// which goes chunk by chunk and therefore needs the signed offsets
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+#include "BufferedFileWriter.h"
+#include "VoxelArray.h"
+#include "VoxelGrid.h"
+
+struct VoxelFileHeader {
+    float voxel_size = 0;
+    Eigen::Vector3f grid_min = Eigen::Vector3f::Zero();
+    Eigen::Vector3i voxels_per_dim = Eigen::Vector3i::Zero();
+    uint64_t num_voxels = 0;
+    // indexed by class, empty for color grids
+    std::vector<Eigen::Vector3i> class_colors;
+    
+    void Write(BufferedFileWriter& file_out) const;
+    // returns the bytes the header takes up at data, 0 if it is not valid
+    size_t Read(const char* data, const size_t size);
+};
+
+// Encodes the runs of a voxel file from its voxels, added in the order they
+// are to be read back. The pending run is written by Flush
+class VoxelRunWriter {
+public:
+    // with_classes: voxels are added with AddClass, otherwise with AddColor
+    VoxelRunWriter(BufferedFileWriter& file_out, const bool with_classes);
+    void AddClass(const VoxelID voxel_id, const int class_i) {
+        if (voxel_id != run_end_ || class_i != run_class_) {
+            Flush();
+            run_start_ = voxel_id;
+            run_class_ = class_i;
+        }
+        run_end_ = voxel_id + 1;
+    }
+    void AddColor(const VoxelID voxel_id, const Eigen::Vector3i& color) {
+        if (voxel_id != run_end_) {
+            Flush();
+            run_start_ = voxel_id;
+        }
+        run_colors_.push_back(color[0]);
+        run_colors_.push_back(color[1]);
+        run_colors_.push_back(color[2]);
+        run_end_ = voxel_id + 1;
+    }
+    void Flush();
+private:
+    BufferedFileWriter& file_out_;
+    const bool with_classes_;
+    // the pending run is [run_start_, run_end_)
+    VoxelID run_start_ = 0;
+    VoxelID run_end_ = 0;
+    VoxelID previous_end_ = 0;
+    int run_class_ = -1;
+    std::vector<uint8_t> run_colors_;
+};
+
+// the voxels of a voxel file as GetOccupiedVoxels returns them, in file order.
+// Classes are 0 in files without class colors. False if the file cannot be
+// read or is malformed
+bool ReadVoxelFile(const std::string& filepath, VoxelArrays& voxels);
+
+#endif /* defined(__VOXELFILE__) */
@@ -9,42 +9,167 @@
 #ifndef __VOXELGRID__
 #define __VOXELGRID__
 
+#include <algorithm>
+#include <functional>
+#include <tuple>
 #include <vector>
 
 //Eigen
 #include <Eigen/Dense>
 #include "tinyply.h"
+#include "BufferedFileWriter.h"
+#include "VoxelArray.h"
+
+struct VoxelFileHeader;
+class VoxelRunWriter;
+
+// returned for vertices outside the grid
+const VoxelID kVoxelOutOfGrid = ~VoxelID(0);
+
+enum class PlyFormat {
+    binary, ascii
+};
+
+// cubes: a separate, slightly shrunk cube per occupied voxel
+// surface: only faces not hidden by an occupied neighbour, corners shared
+// greedy: surface with coplanar faces of the same color merged into rectangles
+enum class MeshStyle {
+    cubes, surface, greedy
+};
+
+// size of a voxel mesh as written
+struct VoxelMeshStats {
+    uint64_t num_vertices = 0;
+    uint64_t num_faces = 0;
+};
+
+// how samples stamped into the same voxel combine
+// last: the last sample wins, so the result depends on stamping order
+// majority: classes by majority vote over all samples, ties going to the
+//           lower class, colors as the rounded mean of all samples
+enum class VoxelAggregation {
+    last, majority
+};
+
+// instruction sets the batched voxel id computation can run on
+enum class SimdLevel {
+    scalar, sse2, avx2
+};
+
+// occupied voxels of a grid as contiguous arrays, in order of voxel id. Per
+// voxel: its x, y, z index in the grid, the x, y, z of its center, its red,
+// green, blue color and its class (0 in color mode). A voxel's center is
+// grid_min + (index + 0.5) * voxel_size
+struct VoxelArrays {
+    float voxel_size = 0;
+    Eigen::Vector3f grid_min = Eigen::Vector3f::Zero();
+    std::vector<int32_t> coordinates;
+    std::vector<float> centers;
+    std::vector<uint8_t> colors;
+    std::vector<uint16_t> classes;
+    
+    size_t size() const { return classes.size(); }
+};
 
 class VoxelGridInterface {
 public:
     VoxelGridInterface(const Eigen::Vector3f& grid_min,
                        const Eigen::Vector3f& grid_max,
-                       float voxel_size);
-    virtual const Eigen::Vector3i& GetVoxelsPerDim() const;
-    virtual uint32_t GetEnclosingVoxelID(const Eigen::Vector3f& vertex) const;
-    void SaveAsPLY(const std::string& filepath) const;
-    void SaveAsPLYMesh(const std::string& filepath) const;
+                       float voxel_size,
+                       const VoxelStorage storage = VoxelStorage::dense);
+    const Eigen::Vector3i& GetVoxelsPerDim() const;
+    const Eigen::Vector3f& GetGridMin() const;
+    float GetVoxelSize() const;
+    // voxel coordinates are offsets from the grid min times this, as in
+    // GetEnclosingVoxel
+    float GetInverseVoxelSize() const;
+    VoxelID GetEnclosingVoxelID(const Eigen::Vector3f& vertex) const;
+    // GetEnclosingVoxelID of num_points contiguous points, with the widest
+    // instruction set the CPU supports. Results are identical on all of them
+    void GetEnclosingVoxelIDs(const Eigen::Vector3f* points, const size_t num_points, VoxelID* voxel_ids) const;
+    // the same on simd_level, which the CPU must support
+    void GetEnclosingVoxelIDs(const Eigen::Vector3f* points, const size_t num_points, VoxelID* voxel_ids,
+                              const SimdLevel simd_level) const;
+    static SimdLevel GetSupportedSimdLevel();
+    bool GetEnclosingVoxel(const Eigen::Vector3f& vertex, Eigen::Vector3i& voxel) const;
+    VoxelID GetVoxelID(const Eigen::Vector3i& voxel) const;
+    Eigen::Vector3i GetVoxel(const VoxelID voxel_id) const;
+    virtual uint64_t GetNumOccupied() const = 0;
+    VoxelAggregation GetAggregation() const;
+    // atomic storage: voxels may be set from several threads at once. Reads
+    // are only consistent once all writers are done
+    bool SupportsConcurrentWrites() const;
+    // false if the file could not be written completely
+    virtual bool SaveAsPLY(const std::string& filepath) const = 0;
+    // the voxels SaveAsPLY writes, reusing the storage of voxels
+    virtual void GetOccupiedVoxels(VoxelArrays& voxels) const = 0;
+    // out-of-core output, written piecewise in SaveAsPLY's binary layout. The
+    // count is padded to a fixed width, so the header can be written with a
+    // placeholder first and rewritten in place once the count is known
+    static void WritePointCloudHeader(BufferedFileWriter& file_out, const uint64_t num_voxels);
+    // appends the occupied voxels whose center passes keep, returns their count
+    virtual uint64_t AppendPointCloud(BufferedFileWriter& file_out,
+                                      const std::function<bool(const Eigen::Vector3f&)>& keep) const = 0;
+    // the voxels SaveAsPLY writes as runs of voxel ids, in the compact format
+    // of VoxelFile.h
+    virtual bool SaveAsVoxelFile(const std::string& filepath) const = 0;
+    // out-of-core output in that format, as for point clouds: header (with the
+    // count of the whole grid) and runs are written separately
+    virtual VoxelFileHeader GetVoxelFileHeader() const = 0;
+    virtual uint64_t AppendVoxelRuns(VoxelRunWriter& runs,
+                                     const std::function<bool(const Eigen::Vector3f&)>& keep) const = 0;
+    // binary is little-endian, cubes are streamed to disk as they are
+    // generated. False if the mesh was not written, mesh_stats receives its size
+    bool SaveAsPLYMesh(const std::string& filepath,
+                       const PlyFormat format = PlyFormat::binary,
+                       const MeshStyle style = MeshStyle::cubes,
+                       VoxelMeshStats* mesh_stats = nullptr) const;
 protected:
+    const VoxelStorage storage_;
+    VoxelAggregation aggregation_ = VoxelAggregation::last;
     Eigen::Vector3i voxels_per_dim_;
-    const Eigen::Vector3f grid_min_;
-    const Eigen::Vector3f grid_max_;
-    const float voxel_size_;
-    uint32_t num_voxels_;
+    Eigen::Vector3f grid_min_;
+    Eigen::Vector3f grid_max_;
+    float voxel_size_;
+    float inverse_voxel_size_;
+    VoxelID num_voxels_;
     
-    virtual unsigned int GetNumOccupied() const;
-private:
-    virtual bool IsVoxelOccupied(const uint32_t voxel_id) const = 0;
-    virtual bool IsVoxelOccupied(const Eigen::Vector3f& vertex) const;
+    // voxel face visible from direction (axis, sign), at voxel coordinate slice
+    // along the axis and u, v along the two other axes in cyclic order
+    struct VoxelFace {
+        int slice, v, u;
+        uint32_t color;
+        bool operator<(const VoxelFace& other) const {
+            return std::tie(slice, v, u) < std::tie(other.slice, other.v, other.u);
+        }
+    };
+    
+    void SetBounds(const Eigen::Vector3f& grid_min, const Eigen::Vector3f& grid_max, const float voxel_size);
     
-    virtual unsigned int GetNumOccupiedVoxels() const = 0;
-    virtual const Eigen::Vector3i& GetVoxelColor(const uint32_t voxel_id) const = 0;
-    virtual int GetVoxelClass(const uint32_t voxel_id) const;
+    // visits voxel_ids in order, for grids that only know the ids of their
+    // occupied voxels
+    template <typename Function>
+    void ForEachVoxelID(std::vector<VoxelID>& voxel_ids, const Function& function) const {
+        std::sort(voxel_ids.begin(), voxel_ids.end());
+        for (const auto& voxel_id: voxel_ids)
+            function(voxel_id, GetVoxel(voxel_id));
+    }
     
-    void WritePlyHeader(std::ofstream& file_out_, const int vertex, const int faces) const;
-    void WriteVertex(std::stringstream& vertices_,
+    void WritePlyHeader(BufferedFileWriter& file_out, const PlyFormat format,
+                        const uint64_t num_vertices, const uint64_t num_faces) const;
+    void WriteVertex(BufferedFileWriter& file_out, const PlyFormat format,
                      const Eigen::Vector3f& pos, const Eigen::Vector3i& color) const;
-    void WriteFace(std::stringstream& faces_,
-                                       const int index1, const int index2, const int index3) const;
+    void WriteFace(BufferedFileWriter& file_out, const PlyFormat format,
+                   const int index1, const int index2, const int index3) const;
+    // header and cube vertices
+    virtual void WriteCubeMesh(BufferedFileWriter& file_out, const PlyFormat format) const = 0;
+    void WriteCubeFaces(BufferedFileWriter& file_out, const PlyFormat format, const uint64_t num_cubes) const;
+    // faces of occupied voxels not hidden by an occupied neighbour, by
+    // direction: +x, -x, +y, -y, +z, -z
+    virtual void GetSurfaceFaces(std::vector<VoxelFace> faces[6]) const = 0;
+    // false, with nothing written, if the vertex indices would overflow int32
+    bool WriteSurfaceMesh(BufferedFileWriter& file_out, const PlyFormat format, const bool merge_faces,
+                          uint64_t& num_vertices, uint64_t& num_faces) const;
     
     /*void WriteFace(std::vector<uint32_t>& local_faces, int& index,
      const int v1, const int v2, const int v3) const;
@@ -57,4 +182,38 @@ private:
      int& vertex_index) const;*/
 };
 
+// Voxel grid of concrete type Grid, which derives from VoxelGrid<Grid>. The
+// exports loop over the occupied voxels with Grid's own, non-virtual access
+// to them, so it inlines. Grid implements
+//     uint64_t GetNumOccupiedVoxels() const;
+//     bool IsVoxelOccupied(const VoxelID voxel_id) const;
+//     Eigen::Vector3i GetVoxelColor(const VoxelID voxel_id) const;
+//     int GetVoxelClass(const VoxelID voxel_id) const;
+//     // colors by class, empty for grids of colors
+//     const std::vector<Eigen::Vector3i>& GetClassColors() const;
+//     // function(voxel_id, voxel) per occupied voxel, in order of voxel id
+//     template <typename Function>
+//     void ForEachOccupiedVoxel(const Function& function) const;
+// The members are defined in VoxelGridExport.h, which the .cpp of each grid
+// type includes to instantiate them next to the definitions of its access
+template <typename Grid>
+class VoxelGrid: public VoxelGridInterface {
+public:
+    using VoxelGridInterface::VoxelGridInterface;
+    virtual uint64_t GetNumOccupied() const override;
+    virtual bool SaveAsPLY(const std::string& filepath) const override;
+    virtual void GetOccupiedVoxels(VoxelArrays& voxels) const override;
+    virtual uint64_t AppendPointCloud(BufferedFileWriter& file_out,
+                                      const std::function<bool(const Eigen::Vector3f&)>& keep) const override;
+    virtual bool SaveAsVoxelFile(const std::string& filepath) const override;
+    virtual VoxelFileHeader GetVoxelFileHeader() const override;
+    virtual uint64_t AppendVoxelRuns(VoxelRunWriter& runs,
+                                     const std::function<bool(const Eigen::Vector3f&)>& keep) const override;
+protected:
+    virtual void WriteCubeMesh(BufferedFileWriter& file_out, const PlyFormat format) const override;
+    virtual void GetSurfaceFaces(std::vector<VoxelFace> faces[6]) const override;
+private:
+    const Grid& GetGrid() const { return static_cast<const Grid&>(*this); }
+};
+
 #endif /* defined(__ColoredVOXELGRID__) */
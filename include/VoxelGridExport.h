@@ -0,0 +1,224 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#ifndef __VOXELGRIDEXPORT__
+#define __VOXELGRIDEXPORT__
+
+// Members of VoxelGrid<Grid>. Only the .cpp of a grid type includes this, and
+// instantiates them for it after defining its voxel access
+
+#include <fstream>
+#include <iostream>
+
+#include "VoxelFile.h"
+#include "VoxelGrid.h"
+#include "tinyply.h"
+
+template <typename Grid>
+uint64_t VoxelGrid<Grid>::GetNumOccupied() const {
+    return GetGrid().GetNumOccupiedVoxels();
+}
+
+template <typename Grid>
+bool VoxelGrid<Grid>::SaveAsPLY(const std::string& filepath) const {
+    const Grid& grid = GetGrid();
+    const uint64_t num_occupied_voxels = grid.GetNumOccupiedVoxels();
+    std::vector<float> vertices(num_occupied_voxels * 3);
+    std::vector<uint8_t> colors(num_occupied_voxels * 4);
+    std::vector<int> labels(num_occupied_voxels);
+    size_t raw_vertex_i = 0;
+    size_t raw_color_i = 0;
+    size_t raw_label_i = 0;
+    grid.ForEachOccupiedVoxel([&](const VoxelID voxel_id, const Eigen::Vector3i& voxel) {
+        const Eigen::Vector3i& color = grid.GetVoxelColor(voxel_id);
+        int label = grid.GetVoxelClass(voxel_id);
+        Eigen::Vector3f voxel_pos((voxel[0] * voxel_size_) + grid_min_[0] + voxel_size_ / 2,
+                                  (voxel[1] * voxel_size_) + grid_min_[1] + voxel_size_ / 2,
+                                  (voxel[2] * voxel_size_) + grid_min_[2] + voxel_size_ / 2);
+        vertices[raw_vertex_i++] = voxel_pos[0];
+        vertices[raw_vertex_i++] = voxel_pos[1];
+        vertices[raw_vertex_i++] = voxel_pos[2];
+        colors[raw_color_i++] = color[0];
+        colors[raw_color_i++] = color[1];
+        colors[raw_color_i++] = color[2];
+        colors[raw_color_i++] = 255;
+        labels[raw_label_i++] = label;
+    });
+    std::filebuf fb;
+    if (fb.open(filepath, std::ios::out | std::ios::binary) == nullptr) {
+        std::cerr << "Error: cannot write " << filepath << std::endl;
+        return false;
+    }
+    std::ostream ss(&fb);
+    tinyply::PlyFile out_file;
+    out_file.add_properties_to_element("vertex", { "x", "y", "z" }, vertices);
+    out_file.add_properties_to_element("vertex", { "red", "green", "blue", "alpha" }, colors);
+    out_file.add_properties_to_element("vertex", { "label" }, labels);
+    out_file.write(ss, true);
+    if (!ss.flush() || fb.close() == nullptr) {
+        std::cerr << "Error: could not write all of " << filepath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <typename Grid>
+void VoxelGrid<Grid>::GetOccupiedVoxels(VoxelArrays& voxels) const {
+    const Grid& grid = GetGrid();
+    const uint64_t num_occupied_voxels = grid.GetNumOccupiedVoxels();
+    voxels.voxel_size = voxel_size_;
+    voxels.grid_min = grid_min_;
+    voxels.coordinates.clear();
+    voxels.centers.clear();
+    voxels.colors.clear();
+    voxels.classes.clear();
+    voxels.coordinates.reserve(3 * num_occupied_voxels);
+    voxels.centers.reserve(3 * num_occupied_voxels);
+    voxels.colors.reserve(3 * num_occupied_voxels);
+    voxels.classes.reserve(num_occupied_voxels);
+    grid.ForEachOccupiedVoxel([&](const VoxelID voxel_id, const Eigen::Vector3i& voxel) {
+        const Eigen::Vector3i color = grid.GetVoxelColor(voxel_id);
+        for (int i = 0; i < 3; i++) {
+            voxels.coordinates.push_back(voxel[i]);
+            voxels.centers.push_back((voxel[i] * voxel_size_) + grid_min_[i] + voxel_size_ / 2);
+            voxels.colors.push_back(color[i]);
+        }
+        voxels.classes.push_back(grid.GetVoxelClass(voxel_id));
+    });
+}
+
+template <typename Grid>
+uint64_t VoxelGrid<Grid>::AppendPointCloud(BufferedFileWriter& file_out,
+                                           const std::function<bool(const Eigen::Vector3f&)>& keep) const {
+    const Grid& grid = GetGrid();
+    uint64_t num_written = 0;
+    grid.ForEachOccupiedVoxel([&](const VoxelID voxel_id, const Eigen::Vector3i& voxel) {
+        Eigen::Vector3f voxel_pos((voxel[0] * voxel_size_) + grid_min_[0] + voxel_size_ / 2,
+                                  (voxel[1] * voxel_size_) + grid_min_[1] + voxel_size_ / 2,
+                                  (voxel[2] * voxel_size_) + grid_min_[2] + voxel_size_ / 2);
+        if (!keep(voxel_pos))
+            return;
+        const Eigen::Vector3i color = grid.GetVoxelColor(voxel_id);
+        for (int i = 0; i < 3; i++)
+            file_out.WriteLittleEndian(voxel_pos[i]);
+        for (int i = 0; i < 3; i++)
+            file_out.WriteLittleEndian(static_cast<uint8_t>(color[i]));
+        file_out.WriteLittleEndian(static_cast<uint8_t>(255));
+        file_out.WriteLittleEndian(static_cast<int32_t>(grid.GetVoxelClass(voxel_id)));
+        num_written++;
+    });
+    return num_written;
+}
+
+template <typename Grid>
+bool VoxelGrid<Grid>::SaveAsVoxelFile(const std::string& filepath) const {
+    BufferedFileWriter file_out(filepath);
+    if (!file_out.IsOpen()) {
+        std::cerr << "Error: cannot write " << filepath << std::endl;
+        return false;
+    }
+    const VoxelFileHeader header = GetVoxelFileHeader();
+    header.Write(file_out);
+    VoxelRunWriter runs(file_out, !header.class_colors.empty());
+    AppendVoxelRuns(runs, [](const Eigen::Vector3f&) { return true; });
+    runs.Flush();
+    if (!file_out.Close()) {
+        std::cerr << "Error: could not write all of " << filepath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <typename Grid>
+VoxelFileHeader VoxelGrid<Grid>::GetVoxelFileHeader() const {
+    const Grid& grid = GetGrid();
+    VoxelFileHeader header;
+    header.voxel_size = voxel_size_;
+    header.grid_min = grid_min_;
+    header.voxels_per_dim = voxels_per_dim_;
+    header.num_voxels = grid.GetNumOccupiedVoxels();
+    header.class_colors = grid.GetClassColors();
+    return header;
+}
+
+template <typename Grid>
+uint64_t VoxelGrid<Grid>::AppendVoxelRuns(VoxelRunWriter& runs,
+                                          const std::function<bool(const Eigen::Vector3f&)>& keep) const {
+    const Grid& grid = GetGrid();
+    const bool with_classes = !grid.GetClassColors().empty();
+    uint64_t num_written = 0;
+    grid.ForEachOccupiedVoxel([&](const VoxelID voxel_id, const Eigen::Vector3i& voxel) {
+        Eigen::Vector3f voxel_pos((voxel[0] * voxel_size_) + grid_min_[0] + voxel_size_ / 2,
+                                  (voxel[1] * voxel_size_) + grid_min_[1] + voxel_size_ / 2,
+                                  (voxel[2] * voxel_size_) + grid_min_[2] + voxel_size_ / 2);
+        if (!keep(voxel_pos))
+            return;
+        if (with_classes)
+            runs.AddClass(voxel_id, grid.GetVoxelClass(voxel_id));
+        else
+            runs.AddColor(voxel_id, grid.GetVoxelColor(voxel_id));
+        num_written++;
+    });
+    return num_written;
+}
+
+template <typename Grid>
+void VoxelGrid<Grid>::WriteCubeMesh(BufferedFileWriter& file_out, const PlyFormat format) const {
+    // the cube count is known upfront, so the header goes first and vertices
+    // and faces are streamed out without holding the mesh in memory
+    const Grid& grid = GetGrid();
+    const uint64_t num_occupied_voxels = grid.GetNumOccupiedVoxels();
+    WritePlyHeader(file_out, format, 8 * num_occupied_voxels, 12 * num_occupied_voxels);
+    
+    const float voxel_size = voxel_size_ / 2.0f * 0.95f;
+    grid.ForEachOccupiedVoxel([&](const VoxelID voxel_id, const Eigen::Vector3i& voxel) {
+        const Eigen::Vector3i& color = grid.GetVoxelColor(voxel_id);
+        Eigen::Vector3f point((voxel[0] * voxel_size_) + grid_min_[0] + voxel_size_ / 2,
+                              (voxel[1] * voxel_size_) + grid_min_[1] + voxel_size_ / 2,
+                              (voxel[2] * voxel_size_) + grid_min_[2] + voxel_size_ / 2);
+        WriteVertex(file_out, format,
+                    Eigen::Vector3f(-voxel_size + point[0], voxel_size + point[1], voxel_size + point[2]), color);
+        WriteVertex(file_out, format,
+                    Eigen::Vector3f(-voxel_size + point[0], voxel_size + point[1], -voxel_size + point[2]), color);
+        WriteVertex(file_out, format,
+                    Eigen::Vector3f(voxel_size + point[0], voxel_size + point[1], -voxel_size + point[2]), color);
+        WriteVertex(file_out, format,
+                    Eigen::Vector3f(voxel_size + point[0], voxel_size + point[1], voxel_size + point[2]), color);
+        WriteVertex(file_out, format,
+                    Eigen::Vector3f(-voxel_size + point[0], -voxel_size + point[1], voxel_size + point[2]), color);
+        WriteVertex(file_out, format,
+                    Eigen::Vector3f(-voxel_size + point[0], -voxel_size + point[1], -voxel_size + point[2]), color);
+        WriteVertex(file_out, format,
+                    Eigen::Vector3f(voxel_size + point[0], -voxel_size + point[1], -voxel_size + point[2]), color);
+        WriteVertex(file_out, format,
+                    Eigen::Vector3f(voxel_size + point[0], -voxel_size + point[1], voxel_size + point[2]), color);
+    });
+    WriteCubeFaces(file_out, format, num_occupied_voxels);
+}
+
+template <typename Grid>
+void VoxelGrid<Grid>::GetSurfaceFaces(std::vector<VoxelFace> faces[6]) const {
+    // faces hidden by an occupied neighbour are dropped, faces on the grid
+    // border are kept
+    const Grid& grid = GetGrid();
+    grid.ForEachOccupiedVoxel([&](const VoxelID voxel_id, const Eigen::Vector3i& voxel) {
+        const Eigen::Vector3i& color = grid.GetVoxelColor(voxel_id);
+        const uint32_t packed_color = (color[0] & 0xFF) << 16 | (color[1] & 0xFF) << 8 | (color[2] & 0xFF);
+        for (int direction = 0; direction < 6; direction++) {
+            const int axis = direction / 2;
+            Eigen::Vector3i neighbour = voxel;
+            neighbour[axis] += (direction % 2 == 0) ? 1 : -1;
+            if (neighbour[axis] >= 0 && neighbour[axis] < voxels_per_dim_[axis] &&
+                grid.IsVoxelOccupied(GetVoxelID(neighbour)))
+                continue;
+            faces[direction].push_back({voxel[axis], voxel[(axis + 2) % 3], voxel[(axis + 1) % 3], packed_color});
+        }
+    });
+}
+
+#endif /* defined(__VOXELGRIDEXPORT__) */
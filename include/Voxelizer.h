@@ -11,6 +11,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
 #include <vector>
 #include <math.h>
 #include <string>
@@ -18,21 +22,216 @@
 
 #include "VoxelGrid.h"
 
+// Vertex attribute array as seen by one voxelization worker. Indices below the
+// size of the shared input refer to the input, indices above it refer to the
+// midpoints this worker created, so sub-faces can be remapped when merging.
+template <typename T>
+class ScratchArray {
+public:
+    explicit ScratchArray(const std::vector<T>& shared): shared_(shared) {}
+    const T& operator[](const size_t i) const {
+        return (i < shared_.size()) ? shared_[i] : local_[i - shared_.size()];
+    }
+    void push_back(const T& value) { local_.push_back(value); }
+    void pop_back() { local_.pop_back(); }
+    size_t size() const { return shared_.size() + local_.size(); }
+    const std::vector<T>& local() const { return local_; }
+private:
+    const std::vector<T>& shared_;
+    std::vector<T> local_;
+};
+
+// split: recursive longest-edge bisection, stamps the voxels of the resulting
+//        sub-face vertices (reference mode)
+// raster: stamps every voxel whose box intersects the triangle, without
+//         creating any new vertices
+enum class VoxelizationMethod {
+    split, raster
+};
+
+// voxel hit by a face and the barycentric weights of the point on the face
+// closest to the voxel center, used to pick the class or blend the color
+struct VoxelSample {
+    VoxelID voxel_id;
+    Eigen::Vector3f barycentric;
+};
+
+// vertex indices of a triangle
+typedef std::array<uint32_t, 3> Face;
+
+// work done by the last Voxelize call. split_seconds covers splitting faces,
+// or rasterizing them, stamp_seconds writing the grids, both summed over the
+// threads running them. Where splitting and stamping interleave, stamping
+// time is extrapolated from every kStampSampling-th leaf sub-face, as timing
+// every one would cost about as much as stamping it
+struct VoxelizeStats {
+    uint64_t num_midpoints = 0;
+    uint64_t num_sub_faces = 0;
+    double split_seconds = 0;
+    double stamp_seconds = 0;
+    
+    VoxelizeStats& operator+=(const VoxelizeStats& other) {
+        num_midpoints += other.num_midpoints;
+        num_sub_faces += other.num_sub_faces;
+        split_seconds += other.split_seconds;
+        stamp_seconds += other.stamp_seconds;
+        return *this;
+    }
+};
+
+// Base of the class and color voxelizers. Their Voxelize leaves the mesh
+// passed in untouched on every path: midpoints created while splitting live
+// in scratch arrays of the voxelizer, and only the grids are written.
 class Voxelizer {
 public:
+    void SetNumThreads(const int num_threads);
+    void SetMethod(const VoxelizationMethod method);
+    // progress to stdout, off by default
+    void SetVerbose(const bool verbose);
+    const VoxelizeStats& GetStats() const;
 protected:
     const float kVoxelizerMinTriangleArea = 0.00001;
-    virtual Eigen::Vector3f GetMidpoint(const Eigen::Vector3f& v1, const Eigen::Vector3f& v2) const;
-    virtual const float EuclideanDistance(const Eigen::Vector3f& v1, const Eigen::Vector3f& v2) const;
-    virtual const float AreaOfTriangle(const Eigen::Vector3f& v1,
-                                       const Eigen::Vector3f& v2,
-                                       const Eigen::Vector3f& v3) const;
-    virtual int SplitBaseFace(const VoxelGridInterface& voxel_grid,
-                              std::vector<Eigen::Vector3f>& vertices,
-                              std::vector<uint32_t>& face,
-                              std::vector<uint32_t>& sub_faces,
-                              std::vector<uint32_t>& first_sub_face,
-                              std::vector<uint32_t>& second_sub_face) const;
+    static const uint64_t kStampSampling = 64;
+    int num_threads_ = 1;
+    VoxelizationMethod method_ = VoxelizationMethod::split;
+    bool verbose_ = false;
+    VoxelizeStats stats_;
+    // not virtual, so the splitting loops inline them
+    Eigen::Vector3f GetMidpoint(const Eigen::Vector3f& v1, const Eigen::Vector3f& v2) const;
+    const float EuclideanDistance(const Eigen::Vector3f& v1, const Eigen::Vector3f& v2) const;
+    const float AreaOfTriangle(const Eigen::Vector3f& v1,
+                               const Eigen::Vector3f& v2,
+                               const Eigen::Vector3f& v3) const;
+    // splits face at the midpoint of its longest edge crossing a voxel
+    // boundary, appending the midpoint to vertices. Returns the index of that
+    // edge, or -1 if face is a leaf: in a single voxel or too small to split
+    int SplitBaseFace(const VoxelGridInterface& voxel_grid,
+                      std::vector<Eigen::Vector3f>& vertices,
+                      const Face& face,
+                      Face& first_sub_face,
+                      Face& second_sub_face) const;
+    int SplitBaseFace(const VoxelGridInterface& voxel_grid,
+                      ScratchArray<Eigen::Vector3f>& vertices,
+                      const Face& face,
+                      Face& first_sub_face,
+                      Face& second_sub_face) const;
+    // a face still to be split, or the marker that both sub-faces of a split
+    // face are done
+    struct SplitTask {
+        Face face;
+        bool sub_faces_done;
+    };
+    // Splits face until all sub-faces are leaves, depth first with the first
+    // sub-face before the second like the original recursion, on an explicit
+    // stack that is only reused storage. on_split(face, longest_i) sees every
+    // face split, after its midpoint was appended to vertices, on_leaf(face)
+    // every leaf, and on_sub_faces_done() follows the last leaf of a split face
+    template <typename VertexArray, typename SplitFunction, typename LeafFunction, typename DoneFunction>
+    void SubdivideFace(const VoxelGridInterface& voxel_grid,
+                       VertexArray& vertices,
+                       const Face& face,
+                       std::vector<SplitTask>& stack,
+                       const SplitFunction& on_split,
+                       const LeafFunction& on_leaf,
+                       const DoneFunction& on_sub_faces_done) const {
+        Face first_sub_face;
+        Face second_sub_face;
+        stack.clear();
+        stack.push_back({ face, false });
+        while (!stack.empty()) {
+            const SplitTask task = stack.back();
+            stack.pop_back();
+            if (task.sub_faces_done) {
+                on_sub_faces_done();
+                continue;
+            }
+            const int longest_i = SplitBaseFace(voxel_grid, vertices, task.face, first_sub_face, second_sub_face);
+            if (longest_i == -1) {
+                on_leaf(task.face);
+                continue;
+            }
+            on_split(task.face, longest_i);
+            stack.push_back({ task.face, true });
+            stack.push_back({ second_sub_face, false });
+            stack.push_back({ first_sub_face, false });
+        }
+    }
+    // Face range [first_face, last_face) in units of faces, not indices
+    typedef std::function<void(const size_t chunk_i,
+                               const size_t first_face,
+                               const size_t last_face)> FaceChunkFunction;
+    size_t GetNumFaceChunks(const size_t num_faces) const;
+    // counts a leaf sub-face and stamps it, timing only every kStampSampling-th
+    template <typename Function>
+    static void StampLeaf(VoxelizeStats& stats, const Function& stamp) {
+        if (stats.num_sub_faces++ % kStampSampling != 0) {
+            stamp();
+            return;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        stamp();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        stats.stamp_seconds += kStampSampling * elapsed.count();
+    }
+    // voxel ids of the vertices of sub_faces in every grid, appended to
+    // voxel_ids as num_grids consecutive ids per vertex. Vertices are gathered
+    // in blocks so each grid computes its ids in one batch
+    template <typename VertexArray, typename VoxelGrid>
+    static void AppendSubFaceVoxelIDs(const std::vector<VoxelGrid*>& voxel_grids,
+                                      const VertexArray& vertices,
+                                      const std::vector<uint32_t>& sub_faces,
+                                      std::vector<VoxelID>& voxel_ids) {
+        const size_t kBlockSize = 256;
+        const size_t num_grids = voxel_grids.size();
+        Eigen::Vector3f points[kBlockSize];
+        VoxelID block_voxel_ids[kBlockSize];
+        voxel_ids.reserve(voxel_ids.size() + num_grids * sub_faces.size());
+        for (size_t first = 0; first < sub_faces.size(); first += kBlockSize) {
+            const size_t num_points = std::min(kBlockSize, sub_faces.size() - first);
+            for (size_t j = 0; j < num_points; j++)
+                points[j] = vertices[sub_faces[first + j]];
+            const size_t block_start = voxel_ids.size();
+            voxel_ids.resize(block_start + num_grids * num_points);
+            for (size_t grid_i = 0; grid_i < num_grids; grid_i++) {
+                voxel_grids[grid_i]->GetEnclosingVoxelIDs(points, num_points, block_voxel_ids);
+                for (size_t j = 0; j < num_points; j++)
+                    voxel_ids[block_start + num_grids * j + grid_i] = block_voxel_ids[j];
+            }
+        }
+    }
+    // workers may stamp straight into the grids if all of them take concurrent
+    // writes and their result doesn't depend on the order of the writes
+    template <typename VoxelGrid>
+    bool CanStampConcurrently(const std::vector<VoxelGrid*>& voxel_grids) const {
+        for (const auto& voxel_grid: voxel_grids) {
+            if (!voxel_grid->SupportsConcurrentWrites() || voxel_grid->GetAggregation() != VoxelAggregation::majority)
+                return false;
+        }
+        return num_threads_ > 1;
+    }
+    // returns the seconds spent processing chunks, summed over the workers
+    double ForEachFaceChunk(const size_t num_faces, const FaceChunkFunction& process_chunk) const;
+    void RasterizeFace(const VoxelGridInterface& voxel_grid,
+                       const Eigen::Vector3f& v1,
+                       const Eigen::Vector3f& v2,
+                       const Eigen::Vector3f& v3,
+                       std::vector<VoxelSample>& samples) const;
+private:
+    bool TriangleOverlapsBox(const Eigen::Vector3f& box_center,
+                             const Eigen::Vector3f& box_half_size,
+                             const Eigen::Vector3f& v1,
+                             const Eigen::Vector3f& v2,
+                             const Eigen::Vector3f& v3) const;
+    Eigen::Vector3f GetClosestPointBarycentric(const Eigen::Vector3f& point,
+                                               const Eigen::Vector3f& v1,
+                                               const Eigen::Vector3f& v2,
+                                               const Eigen::Vector3f& v3) const;
+    template <typename VertexArray>
+    int SplitBaseFaceImpl(const VoxelGridInterface& voxel_grid,
+                          VertexArray& vertices,
+                          const Face& face,
+                          Face& first_sub_face,
+                          Face& second_sub_face) const;
 };
 
 #endif /* defined(__MULTICLASSVOXELIZER__) */
@@ -48,6 +48,7 @@ namespace tinyply
 		uint8_t * data;
 		size_t offset;
 		bool realloc = false;
+		size_t listCapacity = 0; // bytes allocated for list properties
 	};
 
 	class PlyProperty
@@ -212,6 +213,10 @@ namespace tinyply
 		PlyFile(std::istream & is);
 
 		void read(std::istream & is);
+		// binary body already in memory, e.g. a mapped file past its header. `consumed` is
+		// called with the end of the decoded range every few MB, so the caller can drop it
+		void read(const char * body, size_t size, const std::function<void(const char *)> & consumed = nullptr);
+		bool is_binary() const { return isBinary; }
 		void write(std::ostream & os, bool isBinary);
 
 		std::vector<PlyElement> & get_elements() { return elements; }
@@ -222,15 +227,100 @@ namespace tinyply
 		template<typename T>
 		size_t request_properties_from_element(const std::string & elementKey, std::vector<std::string> propertyKeys, std::vector<T> & source, const int listCount = 1)
 		{
-			if (get_elements().size() == 0)
+			std::shared_ptr<DataCursor> cursor;
+			size_t totalInstanceSize = 0;
+			size_t numKeys = 0;
+			if (!create_cursor(elementKey, propertyKeys, property_type_for_type(source), cursor, totalInstanceSize, numKeys))
 				return 0;
 
+			totalInstanceSize *= listCount;
+			source.resize(totalInstanceSize); // this satisfies regular properties; `cursor->realloc` is for list types since tinyply uses single-pass parsing
+			cursor->offset = 0;
+			cursor->vector = &source;
+			cursor->data = reinterpret_cast<uint8_t *>(source.data());
+			cursor->listCapacity = source.size() * sizeof(T);
+
+			if (listCount > 1)
+			{
+				cursor->realloc = true;
+				return (totalInstanceSize / numKeys) / listCount;
+			}
+
+			return totalInstanceSize / numKeys;
+		}
+
+		// Decodes the properties straight into caller-owned storage for element size * number of
+		// properties values of T, e.g. the components of a std::vector<Eigen::Vector3f> sized to the
+		// element. Not for list properties.
+		template<typename T>
+		size_t request_properties_from_element(const std::string & elementKey, std::vector<std::string> propertyKeys, T * data)
+		{
+			std::vector<T> typeTag;
+			std::shared_ptr<DataCursor> cursor;
+			size_t totalInstanceSize = 0;
+			size_t numKeys = 0;
+			if (!create_cursor(elementKey, propertyKeys, property_type_for_type(typeTag), cursor, totalInstanceSize, numKeys))
+				return 0;
+
+			cursor->offset = 0;
+			cursor->vector = nullptr;
+			cursor->data = reinterpret_cast<uint8_t *>(data);
+			return totalInstanceSize / numKeys;
+		}
+
+		size_t get_element_size(const std::string & elementKey)
+		{
+			const int idx = find_element(elementKey, elements);
+			return (idx >= 0) ? elements[idx].size : 0;
+		}
+
+		template<typename T>
+		void add_properties_to_element(const std::string & elementKey, const std::vector<std::string> & propertyKeys, std::vector<T> & source, const int listCount = 1, const PlyProperty::Type listType = PlyProperty::Type::INVALID)
+		{
+			auto cursor = std::make_shared<DataCursor>();
+			cursor->offset = 0;
+			cursor->vector = &source;
+			cursor->data = reinterpret_cast<uint8_t *>(source.data());
+
+			auto create_property_on_element = [&](PlyElement & e)
+			{
+				for (auto key : propertyKeys)
+				{
+					PlyProperty::Type t = property_type_for_type(source);
+					PlyProperty newProp = (listType == PlyProperty::Type::INVALID) ? PlyProperty(t, key) : PlyProperty(listType, t, key, listCount);
+					userDataTable.insert(std::pair<std::string, std::shared_ptr<DataCursor>>(make_key(e.name, key), cursor));
+					e.properties.push_back(newProp);
+				}
+			};
+
+			int idx = find_element(elementKey, elements);
+			if (idx >= 0)
+			{
+				PlyElement & e = elements[idx];
+				create_property_on_element(e);
+			}
+			else
+			{
+				PlyElement newElement = (listCount == 1) ? PlyElement(elementKey, source.size() / propertyKeys.size()) : PlyElement(elementKey, source.size() / listCount);
+				create_property_on_element(newElement);
+				elements.push_back(newElement);
+			}
+		}
+
+	private:
+
+		bool create_cursor(const std::string & elementKey, std::vector<std::string> propertyKeys, const PlyProperty::Type sourceType,
+			std::shared_ptr<DataCursor> & cursor, size_t & totalInstanceSize, size_t & numKeys)
+		{
+			if (get_elements().size() == 0)
+				return false;
+
 			if (find_element(elementKey, get_elements()) >= 0)
 			{
 				if (std::find(requestedElements.begin(), requestedElements.end(), elementKey) == requestedElements.end())
 					requestedElements.push_back(elementKey);
 			}
-			else return 0;
+			else return false;
 
 			// count and verify large enough
 			auto instance_counter = [&](const std::string & _elementKey, const std::string & propertyKey)
@@ -242,7 +332,7 @@ namespace tinyply
 					{
 						if (p.name == propertyKey)
 						{
-							if (PropertyTable[property_type_for_type(source)].stride != PropertyTable[p.propertyType].stride)
+							if (PropertyTable[sourceType].stride != PropertyTable[p.propertyType].stride)
 								throw std::runtime_error("destination vector is wrongly typed to hold this property");
 							return e.size;
 
@@ -278,10 +368,10 @@ namespace tinyply
 			{
 				propertyKeys.erase(std::remove(propertyKeys.begin(), propertyKeys.end(), k), propertyKeys.end());
 			}
-			if (!propertyKeys.size()) return 0;
+			if (!propertyKeys.size()) return false;
 
 			// All requested properties in the userDataTable share the same cursor (thrown into the same flat array)
-			auto cursor = std::make_shared<DataCursor>();
+			cursor = std::make_shared<DataCursor>();
 
 			std::vector<size_t> instanceCounts;
 
@@ -297,60 +387,13 @@ namespace tinyply
 				else continue;
 			}
 
-			size_t totalInstanceSize = [&]() { size_t t = 0; for (auto c : instanceCounts) { t += c; } return t; }() * listCount;
-			source.resize(totalInstanceSize); // this satisfies regular properties; `cursor->realloc` is for list types since tinyply uses single-pass parsing
-			cursor->offset = 0;
-			cursor->vector = &source;
-			cursor->data = reinterpret_cast<uint8_t *>(source.data());
-
-			if (listCount > 1)
-			{
-				cursor->realloc = true;
-				return (totalInstanceSize / propertyKeys.size()) / listCount;
-			}
-
-			return totalInstanceSize / propertyKeys.size();
+			totalInstanceSize = [&]() { size_t t = 0; for (auto c : instanceCounts) { t += c; } return t; }();
+			numKeys = propertyKeys.size();
+			return true;
 		}
 
-		template<typename T>
-		void add_properties_to_element(const std::string & elementKey, const std::vector<std::string> & propertyKeys, std::vector<T> & source, const int listCount = 1, const PlyProperty::Type listType = PlyProperty::Type::INVALID)
-		{
-			auto cursor = std::make_shared<DataCursor>();
-			cursor->offset = 0;
-			cursor->vector = &source;
-			cursor->data = reinterpret_cast<uint8_t *>(source.data());
-
-			auto create_property_on_element = [&](PlyElement & e)
-			{
-				for (auto key : propertyKeys)
-				{
-					PlyProperty::Type t = property_type_for_type(source);
-					PlyProperty newProp = (listType == PlyProperty::Type::INVALID) ? PlyProperty(t, key) : PlyProperty(listType, t, key, listCount);
-					userDataTable.insert(std::pair<std::string, std::shared_ptr<DataCursor>>(make_key(e.name, key), cursor));
-					e.properties.push_back(newProp);
-				}
-			};
-
-			int idx = find_element(elementKey, elements);
-			if (idx >= 0)
-			{
-				PlyElement & e = elements[idx];
-				create_property_on_element(e);
-			}
-			else
-			{
-				PlyElement newElement = (listCount == 1) ? PlyElement(elementKey, source.size() / propertyKeys.size()) : PlyElement(elementKey, source.size() / listCount);
-				create_property_on_element(newElement);
-				elements.push_back(newElement);
-			}
-		}
-
-	private:
-
-		size_t skip_property_binary(const PlyProperty & property, std::istream & is);
 		void skip_property_ascii(const PlyProperty & property, std::istream & is);
 
-		void read_property_binary(PlyProperty::Type t, void * dest, size_t & destOffset, std::istream & is);
 		void read_property_ascii(PlyProperty::Type t, void * dest, size_t & destOffset, std::istream & is);
 		void write_property_ascii(PlyProperty::Type t, std::ostream & os, uint8_t * src, size_t & srcOffset);
 		void write_property_binary(PlyProperty::Type t, std::ostream & os, uint8_t * src, size_t & srcOffset);
@@ -364,6 +407,9 @@ namespace tinyply
 		void read_header_text(std::string line, std::istream & is, std::vector<std::string> & place, int erase = 0);
 
 		void read_internal(std::istream & is);
+		void read_binary_internal(std::istream & is);
+		template<typename TakeFunction> void decode_binary_internal(TakeFunction & take);
+		void decode_property_binary(PlyProperty::Type t, void * dest, const char * src);
 
 		void write_ascii_internal(std::ostream & os);
 		void write_binary_internal(std::ostream & os);
@@ -0,0 +1,209 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#include "BatchVoxelizer.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+
+static bool IsDirectory(const std::string& path) {
+    struct stat path_stat;
+    return stat(path.c_str(), &path_stat) == 0 && S_ISDIR(path_stat.st_mode);
+}
+
+static uint64_t GetFileSize(const std::string& path) {
+    struct stat path_stat;
+    return (stat(path.c_str(), &path_stat) == 0) ? path_stat.st_size : 0;
+}
+
+static std::string GetFileName(const std::string& path) {
+    const size_t slash = path.find_last_of('/');
+    return (slash == std::string::npos) ? path : path.substr(slash + 1);
+}
+
+static bool CreateDirectory(const std::string& directory) {
+    if (directory.empty() || IsDirectory(directory))
+        return true;
+    if (mkdir(directory.c_str(), 0755) != 0) {
+        std::cerr << "Error: cannot create directory " << directory << std::endl;
+        return false;
+    }
+    return true;
+}
+
+BatchVoxelizer::BatchVoxelizer(const VoxelizerFactory& create_voxelizer, const int num_jobs):
+    create_voxelizer_(create_voxelizer), num_jobs_(std::max(1, num_jobs)) {
+}
+
+bool BatchVoxelizer::CollectInputs(const std::string& input) {
+    input_files_.clear();
+    if (IsDirectory(input)) {
+        CollectDirectory(input);
+        std::sort(input_files_.begin(), input_files_.end());
+    } else {
+        std::ifstream manifest(input);
+        if (!manifest) {
+            std::cerr << "Error: cannot read " << input << std::endl;
+            return false;
+        }
+        const size_t slash = input.find_last_of('/');
+        const std::string manifest_dir = (slash == std::string::npos) ? "" : input.substr(0, slash + 1);
+        std::string line;
+        while (std::getline(manifest, line)) {
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            line.erase(0, line.find_first_not_of(" \t"));
+            if (line.empty() || line[0] == '#')
+                continue;
+            input_files_.push_back((line[0] == '/') ? line : manifest_dir + line);
+        }
+    }
+    if (input_files_.empty()) {
+        std::cerr << "Error: no input files found in " << input << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void BatchVoxelizer::CollectDirectory(const std::string& directory) {
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr)
+        return;
+    for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+        const std::string name(entry->d_name);
+        if (name == "." || name == "..")
+            continue;
+        const std::string path = directory + "/" + name;
+        if (IsDirectory(path))
+            CollectDirectory(path);
+        else if (name.size() > 4 && name.compare(name.size() - 4, 4, ".ply") == 0)
+            input_files_.push_back(path);
+    }
+    closedir(dir);
+}
+
+bool BatchVoxelizer::Process(const VoxelType voxel_type,
+                             const std::string& output_dir,
+                             const std::string& mesh_output_dir,
+                             const std::string& report_file,
+                             const VoxelFormat output_format) {
+    // outputs are named after the inputs, which therefore need unique names
+    std::vector<std::string> output_files;
+    std::vector<std::string> mesh_files;
+    std::set<std::string> file_names;
+    for (const auto& input_file: input_files_) {
+        const std::string file_name = GetFileName(input_file);
+        if (!file_names.insert(file_name).second) {
+            std::cerr << "Error: more than one input named " << file_name << std::endl;
+            return false;
+        }
+        const std::string stem = file_name.substr(0, file_name.size() - 4);
+        output_files.push_back(output_dir + "/" + ((output_format == VoxelFormat::cvox) ? stem + ".cvox" : file_name));
+        mesh_files.push_back(mesh_output_dir.empty() ? "" : mesh_output_dir + "/" + stem + "_mesh.ply");
+    }
+    if (!CreateDirectory(output_dir) || !CreateDirectory(mesh_output_dir))
+        return false;
+    
+    const size_t num_scenes = input_files_.size();
+    std::vector<SceneResult> results(num_scenes);
+    std::atomic<size_t> next_scene(0);
+    std::mutex print_mutex;
+    size_t num_done = 0;
+    const auto start = std::chrono::steady_clock::now();
+    
+    auto worker = [&]() {
+        std::unique_ptr<ClassyVoxelizer> voxelizer = create_voxelizer_();
+        for (size_t scene_i = next_scene++; scene_i < num_scenes; scene_i = next_scene++) {
+            SceneResult& result = results[scene_i];
+            const auto scene_start = std::chrono::steady_clock::now();
+            try {
+                result.stats = voxelizer->Process(voxel_type, input_files_[scene_i],
+                                                  output_files[scene_i], mesh_files[scene_i]);
+                if (result.stats.num_faces == 0)
+                    result.error = "no faces";
+                else if (!result.stats.outputs_written)
+                    result.error = "write failed";
+            } catch (const std::exception& e) {
+                result.error = e.what();
+            }
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - scene_start;
+            result.seconds = elapsed.count();
+            for (const auto& output_file: result.stats.output_files)
+                result.output_bytes += GetFileSize(output_file);
+            
+            std::lock_guard<std::mutex> lock(print_mutex);
+            std::cout << "[" << ++num_done << "/" << num_scenes << "] " << input_files_[scene_i] << ": ";
+            if (result.error.empty())
+                std::cout << result.stats.num_occupied_voxels << " voxels in " << result.seconds << " s" << std::endl;
+            else
+                std::cout << "failed (" << result.error << ")" << std::endl;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < num_jobs_; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread: threads)
+        thread.join();
+    
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const size_t num_failed = std::count_if(results.begin(), results.end(),
+                                            [](const SceneResult& result) { return !result.error.empty(); });
+    std::cout << "Voxelized " << num_scenes - num_failed << " of " << num_scenes << " scenes in "
+              << elapsed.count() << " s" << std::endl;
+    const bool summary_written = WriteSummary(output_dir + "/summary.csv", output_files, results);
+    const bool report_written = report_file.empty() || WriteReport(report_file, results);
+    return summary_written && report_written && num_failed == 0;
+}
+
+bool BatchVoxelizer::WriteSummary(const std::string& filepath,
+                                  const std::vector<std::string>& output_files,
+                                  const std::vector<SceneResult>& results) const {
+    std::ofstream summary(filepath);
+    if (!summary) {
+        std::cerr << "Error: cannot write " << filepath << std::endl;
+        return false;
+    }
+    summary << "input,output,vertices,faces,occupied_voxels,output_bytes,seconds,status" << std::endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        const SceneResult& result = results[i];
+        // one output per voxel size, separated by ';'
+        std::string outputs = output_files[i];
+        for (size_t j = 0; j < result.stats.output_files.size(); j++)
+            outputs = (j == 0) ? result.stats.output_files[j] : outputs + ";" + result.stats.output_files[j];
+        summary << input_files_[i] << "," << outputs << ","
+                << result.stats.num_vertices << "," << result.stats.num_faces << ","
+                << result.stats.num_occupied_voxels << "," << result.output_bytes << ","
+                << result.seconds << "," << (result.error.empty() ? "ok" : result.error) << std::endl;
+    }
+    return true;
+}
+
+bool BatchVoxelizer::WriteReport(const std::string& filepath, const std::vector<SceneResult>& results) const {
+    std::ofstream report(filepath);
+    if (!report) {
+        std::cerr << "Error: cannot write " << filepath << std::endl;
+        return false;
+    }
+    report << "[";
+    for (size_t i = 0; i < results.size(); i++) {
+        report << ((i == 0) ? "\n  " : ",\n  ");
+        ClassyVoxelizer::WriteReport(report, input_files_[i], results[i].stats,
+                                     results[i].error.empty() ? "ok" : results[i].error, 2);
+    }
+    report << "\n]" << std::endl;
+    return true;
+}
@@ -0,0 +1,80 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#include "BufferedFileWriter.h"
+#include <cstdarg>
+
+BufferedFileWriter::BufferedFileWriter(const std::string& filepath, const size_t buffer_size):
+    buffer_(buffer_size) {
+    file_ = std::fopen(filepath.c_str(), "wb");
+}
+
+BufferedFileWriter::~BufferedFileWriter() {
+    Close();
+}
+
+bool BufferedFileWriter::IsOpen() const {
+    return file_ != nullptr;
+}
+
+bool BufferedFileWriter::IsGood() const {
+    return !failed_;
+}
+
+void BufferedFileWriter::Write(const void* data, const size_t size) {
+    if (size_ + size > buffer_.size()) {
+        Flush();
+        if (size > buffer_.size()) {
+            if (file_ != nullptr && std::fwrite(data, 1, size, file_) != size)
+                failed_ = true;
+            return;
+        }
+    }
+    memcpy(buffer_.data() + size_, data, size);
+    size_ += size;
+}
+
+void BufferedFileWriter::Print(const char* format, ...) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        va_list args;
+        va_start(args, format);
+        const int length = vsnprintf(buffer_.data() + size_, buffer_.size() - size_, format, args);
+        va_end(args);
+        if (length < 0)
+            return;
+        if (size_ + length < buffer_.size()) {
+            size_ += length;
+            return;
+        }
+        // didn't fit, retry into the emptied buffer
+        Flush();
+    }
+}
+
+void BufferedFileWriter::Flush() {
+    if (file_ != nullptr && size_ > 0 && std::fwrite(buffer_.data(), 1, size_, file_) != size_)
+        failed_ = true;
+    size_ = 0;
+}
+
+void BufferedFileWriter::Rewind() {
+    Flush();
+    if (file_ != nullptr && std::fseek(file_, 0, SEEK_SET) != 0)
+        failed_ = true;
+}
+
+bool BufferedFileWriter::Close() {
+    if (file_ == nullptr)
+        return !failed_;
+    Flush();
+    // buffered writes of the C library may only fail here
+    if (std::fclose(file_) != 0)
+        failed_ = true;
+    file_ = nullptr;
+    return !failed_;
+}
@@ -9,105 +9,594 @@
 #include "ClassyVoxelizer.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <iterator>
+#include <numeric>
 #include <set>
+#include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "tinyply.h"
+#include "BufferedFileWriter.h"
+#include "MappedFile.h"
 #include "MultiClassVoxelGrid.h"
 #include "MultiClassVoxelizer.h"
 #include "ColoredVoxelizer.h"
 #include "ColoredVoxelGrid.h"
+#include "VoxelFile.h"
 
-ClassyVoxelizer::ClassyVoxelizer(const float voxel_size): voxel_size_(voxel_size) {
+ClassyVoxelizer::ClassyVoxelizer(const float voxel_size): voxel_sizes_(1, voxel_size) {
     
 }
 
-void ClassyVoxelizer::Process(const VoxelType voxel_type,
-                              const std::string& input_file,
-                              const std::string& output_file,
-                              const std::string& mesh_output) {
+ClassyVoxelizer::ClassyVoxelizer(const std::vector<float>& voxel_sizes): voxel_sizes_(voxel_sizes) {
+    std::sort(voxel_sizes_.begin(), voxel_sizes_.end());
+    voxel_sizes_.erase(std::unique(voxel_sizes_.begin(), voxel_sizes_.end()), voxel_sizes_.end());
+}
+
+ClassyVoxelizer::~ClassyVoxelizer() = default;
+
+void ClassyVoxelizer::SetNumThreads(const int num_threads) {
+    num_threads_ = num_threads;
+}
+
+void ClassyVoxelizer::SetMethod(const VoxelizationMethod method) {
+    method_ = method;
+}
+
+void ClassyVoxelizer::SetStorage(const VoxelStorage storage) {
+    storage_ = storage;
+}
+
+void ClassyVoxelizer::SetOutputFormat(const VoxelFormat output_format) {
+    output_format_ = output_format;
+}
+
+void ClassyVoxelizer::SetMeshFormat(const PlyFormat mesh_format) {
+    mesh_format_ = mesh_format;
+}
+
+void ClassyVoxelizer::SetMeshStyle(const MeshStyle mesh_style) {
+    mesh_style_ = mesh_style;
+}
+
+void ClassyVoxelizer::SetMappedInput(const bool mapped_input) {
+    mapped_input_ = mapped_input;
+}
+
+void ClassyVoxelizer::SetVerbose(const bool verbose) {
+    verbose_ = verbose;
+}
+
+void ClassyVoxelizer::SetAggregation(const VoxelAggregation aggregation) {
+    aggregation_ = aggregation;
+}
+
+void ClassyVoxelizer::SetChunkSize(const int chunk_size) {
+    chunk_size_ = chunk_size;
+}
+
+void ClassyVoxelizer::SetMemoryBudget(const int memory_budget_mb) {
+    memory_budget_mb_ = memory_budget_mb;
+}
+
+SceneStats ClassyVoxelizer::Process(const VoxelType voxel_type,
+                                    const std::string& input_file,
+                                    const std::string& output_file,
+                                    const std::string& mesh_output) {
+    ClearMesh();
+    SceneStats stats;
+    stats.stages.Start("read");
+    ReadPly(input_file);
+    stats.stages.Stop();
+    if (vertices_.empty() || faces_.empty()) {
+        std::cerr << "Error: no faces read from " << input_file << std::endl;
+        return stats;
+    }
+    for (const auto& voxel_size: voxel_sizes_)
+        stats.output_files.push_back(GetOutputPath(output_file, voxel_size));
+    VoxelizeMesh(voxel_type, mesh_output, nullptr, stats);
+    return stats;
+}
+
+SceneStats ClassyVoxelizer::Voxelize(const VoxelType voxel_type, const MeshView& mesh, std::vector<VoxelArrays>& voxels) {
+    ClearMesh();
+    SceneStats stats;
+    stats.stages.Start("read");
+    const bool loaded = LoadMesh(mesh);
+    stats.stages.Stop();
+    if (!loaded || vertices_.empty() || faces_.empty()) {
+        std::cerr << "Error: no faces in the mesh" << std::endl;
+        voxels.clear();
+        return stats;
+    }
+    VoxelizeMesh(voxel_type, "", &voxels, stats);
+    return stats;
+}
+
+void ClassyVoxelizer::ClearMesh() {
     vertices_.clear();
     faces_.clear();
     vertex_classes_.clear();
     vertex_labels_.clear();
     colormap_.clear();
     colors_.clear();
-    
+}
+
+bool ClassyVoxelizer::LoadMesh(const MeshView& mesh) {
+    if (mesh.positions == nullptr || mesh.faces == nullptr)
+        return false;
+    static_assert(sizeof(Eigen::Vector3f) == 3 * sizeof(float), "Eigen::Vector3f is not packed");
+    const Eigen::Vector3f* positions = reinterpret_cast<const Eigen::Vector3f*>(mesh.positions);
+    vertices_.assign(positions, positions + mesh.num_vertices);
+    faces_.assign(mesh.faces, mesh.faces + 3 * mesh.num_faces);
+    for (const auto& vertex_i: faces_) {
+        if (vertex_i >= mesh.num_vertices) {
+            std::cerr << "Error: face index " << vertex_i << " out of range" << std::endl;
+            return false;
+        }
+    }
+    if (mesh.labels != nullptr)
+        vertex_labels_.assign(mesh.labels, mesh.labels + mesh.num_vertices);
+    colors_.resize(mesh.num_vertices, Eigen::Vector3i::Zero());
+    if (mesh.colors != nullptr) {
+        for (size_t i = 0; i < mesh.num_vertices; i++)
+            colors_[i] << mesh.colors[3*i], mesh.colors[3*i+1], mesh.colors[3*i+2];
+    }
+    return true;
+}
+
+void ClassyVoxelizer::VoxelizeMesh(const VoxelType voxel_type,
+                                   const std::string& mesh_output,
+                                   std::vector<VoxelArrays>* voxels,
+                                   SceneStats& stats) {
+    stats.stages.Start("prepare");
+    stats.num_vertices = vertices_.size();
+    stats.num_faces = faces_.size() / 3;
     if (voxel_type == VoxelType::label) {
-        ReadPly(input_file);
         // if the property label for the class was not found the classes are computed from, the color
         if (vertex_labels_.empty())
             ComputeClassFromColor(vertex_classes_);
         else
             ComputeColorFromLabel(vertex_labels_, num_labels_);
-    } else if (voxel_type == VoxelType::color) {
-        ReadPly(input_file);
     }
-    GetVoxelSpaceDimensions(voxel_size_);
-    std::cout << "Voxelizing at " << voxel_size_ << "m resolution: " << std::flush;
+    GetVoxelSpaceDimensions();
+    if (verbose_) {
+        std::cout << "Voxelizing at ";
+        for (size_t i = 0; i < voxel_sizes_.size(); i++)
+            std::cout << ((i == 0) ? "" : ", ") << voxel_sizes_[i] << "m";
+        std::cout << " resolution: " << std::flush;
+    }
     
+    // grids are padded by one voxel on each side, the finest grid comes first
+    // and drives the subdivision. Out-of-core grids span the whole scene too,
+    // but store only the voxels stamped while voxelizing one chunk
+    const size_t num_grids = voxel_sizes_.size();
+    const bool chunked = ((chunk_size_ > 0 || memory_budget_mb_ > 0) && voxels == nullptr);
+    const VoxelStorage storage = chunked ? VoxelStorage::sparse : storage_;
+    if (chunked && !mesh_output.empty())
+        std::cerr << "Warning: voxel meshes are not written in out-of-core mode" << std::endl;
+    stats.stages.Start("allocate");
     if (voxel_type == VoxelType::label) {
         MultiClassVoxelizer voxelizer;
-        MultiClassVoxelGrid voxelgrid(min_, max_, voxel_size_);
-        voxelgrid.class_color_mapping = colormap_;
-        voxelizer.Voxelize(voxelgrid, vertices_, faces_, vertex_labels_.empty() ? vertex_classes_ : vertex_labels_);
-        voxelgrid.SaveAsPLY(output_file);
-        voxelgrid.SaveAsPLYMesh(mesh_output);
+        voxelizer.SetNumThreads(num_threads_);
+        voxelizer.SetMethod(method_);
+        voxelizer.SetVerbose(verbose_);
+        voxelizer.SetPerFaceParity(chunked);
+        class_grids_.resize(num_grids);
+        std::vector<MultiClassVoxelGrid*> voxel_grids(num_grids);
+        for (size_t i = 0; i < num_grids; i++) {
+            const Eigen::Vector3f padding = Eigen::Vector3f::Constant(voxel_sizes_[i]);
+            if (class_grids_[i])
+                class_grids_[i]->Reset(min_ - padding, max_ + padding, voxel_sizes_[i]);
+            else
+                class_grids_[i].reset(new MultiClassVoxelGrid(min_ - padding, max_ + padding, voxel_sizes_[i], storage));
+            class_grids_[i]->SetAggregation(aggregation_);
+            class_grids_[i]->class_color_mapping = colormap_;
+            voxel_grids[i] = class_grids_[i].get();
+        }
+        std::vector<uint16_t>& classes = vertex_labels_.empty() ? vertex_classes_ : vertex_labels_;
+        if (chunked) {
+            stats.num_occupied_voxels = VoxelizeInChunks(voxelizer, voxel_grids, classes, stats);
+        } else {
+            stats.stages.Start("voxelize");
+            voxelizer.Voxelize(voxel_grids, vertices_, faces_, classes);
+            stats.stages.Stop();
+            stats.num_occupied_voxels = voxel_grids[0]->GetNumOccupied();
+            AddVoxelizeCounts(stats.stages, voxelizer.GetStats(), stats.num_occupied_voxels);
+            OutputGrids(voxel_grids, mesh_output, voxels, stats);
+        }
     } else if (voxel_type == VoxelType::color) {
         ColoredVoxelizer voxelizer;
-        ColoredVoxelGrid voxelgrid(min_, max_, voxel_size_);
-        voxelizer.Voxelize(voxelgrid, vertices_, faces_, colors_);
-        voxelgrid.SaveAsPLY(output_file);
-        voxelgrid.SaveAsPLYMesh(mesh_output);
+        voxelizer.SetNumThreads(num_threads_);
+        voxelizer.SetMethod(method_);
+        voxelizer.SetVerbose(verbose_);
+        color_grids_.resize(num_grids);
+        std::vector<ColoredVoxelGrid*> voxel_grids(num_grids);
+        for (size_t i = 0; i < num_grids; i++) {
+            const Eigen::Vector3f padding = Eigen::Vector3f::Constant(voxel_sizes_[i]);
+            if (color_grids_[i])
+                color_grids_[i]->Reset(min_ - padding, max_ + padding, voxel_sizes_[i]);
+            else
+                color_grids_[i].reset(new ColoredVoxelGrid(min_ - padding, max_ + padding, voxel_sizes_[i], storage));
+            color_grids_[i]->SetAggregation(aggregation_);
+            voxel_grids[i] = color_grids_[i].get();
+        }
+        if (chunked) {
+            stats.num_occupied_voxels = VoxelizeInChunks(voxelizer, voxel_grids, colors_, stats);
+        } else {
+            stats.stages.Start("voxelize");
+            voxelizer.Voxelize(voxel_grids, vertices_, faces_, colors_);
+            stats.stages.Stop();
+            stats.num_occupied_voxels = voxel_grids[0]->GetNumOccupied();
+            AddVoxelizeCounts(stats.stages, voxelizer.GetStats(), stats.num_occupied_voxels);
+            OutputGrids(voxel_grids, mesh_output, voxels, stats);
+        }
+    }
+    stats.stages.Stop();
+    if (verbose_)
+        std::cout << "Peak memory usage: " << StageReport::GetPeakMemoryUsage() / (1024 * 1024) << " MB" << std::endl;
+}
+
+void ClassyVoxelizer::WriteReport(std::ostream& out,
+                                  const std::string& input_file,
+                                  const SceneStats& stats,
+                                  const std::string& status,
+                                  const int indent) {
+    const std::string pad(indent, ' ');
+    out << "{\n" << pad << "  \"input\": " << StageReport::Quote(input_file) << ",\n"
+        << pad << "  \"status\": " << StageReport::Quote(status) << ",\n"
+        << pad << "  \"outputs\": [";
+    for (size_t i = 0; i < stats.output_files.size(); i++)
+        out << ((i == 0) ? "" : ", ") << StageReport::Quote(stats.output_files[i]);
+    out << "],\n"
+        << pad << "  \"vertices\": " << stats.num_vertices << ",\n"
+        << pad << "  \"faces\": " << stats.num_faces << ",\n"
+        << pad << "  \"occupied_voxels\": " << stats.num_occupied_voxels << ",\n"
+        << pad << "  \"stages\": ";
+    stats.stages.WriteJSON(out, indent + 2);
+    out << "\n" << pad << "}";
+}
+
+void ClassyVoxelizer::AddVoxelizeCounts(StageReport& stages, const VoxelizeStats& stats, const uint64_t num_occupied) {
+    stages.AddCount("voxelize", "vertices_created", stats.num_midpoints);
+    stages.AddCount("voxelize", "sub_faces", stats.num_sub_faces);
+    stages.AddCount("voxelize", "split_seconds", stats.split_seconds);
+    stages.AddCount("voxelize", "stamp_seconds", stats.stamp_seconds);
+    stages.AddCount("voxelize", "occupied_voxels", num_occupied);
+}
+
+template <typename Grid>
+void ClassyVoxelizer::OutputGrids(const std::vector<Grid*>& voxel_grids,
+                                  const std::string& mesh_output,
+                                  std::vector<VoxelArrays>* voxels,
+                                  SceneStats& stats) const {
+    if (voxels != nullptr) {
+        stats.stages.Start("extract");
+        voxels->resize(voxel_grids.size());
+        for (size_t i = 0; i < voxel_grids.size(); i++)
+            voxel_grids[i]->GetOccupiedVoxels((*voxels)[i]);
+        return;
+    }
+    stats.stages.Start("save");
+    for (size_t i = 0; i < voxel_grids.size(); i++) {
+        const bool saved = (output_format_ == VoxelFormat::cvox) ? voxel_grids[i]->SaveAsVoxelFile(stats.output_files[i]) :
+                                                                    voxel_grids[i]->SaveAsPLY(stats.output_files[i]);
+        if (!saved)
+            stats.outputs_written = false;
+    }
+    if (mesh_output.empty())
+        return;
+    stats.stages.Start("save_mesh");
+    for (size_t i = 0; i < voxel_grids.size(); i++) {
+        const auto start = std::chrono::steady_clock::now();
+        VoxelMeshStats mesh_stats;
+        if (!voxel_grids[i]->SaveAsPLYMesh(GetOutputPath(mesh_output, voxel_sizes_[i]), mesh_format_, mesh_style_, &mesh_stats)) {
+            stats.outputs_written = false;
+            continue;
+        }
+        stats.stages.AddCount("save_mesh", "mesh_vertices", mesh_stats.num_vertices);
+        stats.stages.AddCount("save_mesh", "mesh_faces", mesh_stats.num_faces);
+        if (!verbose_)
+            continue;
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const uint64_t num_occupied_voxels = voxel_grids[i]->GetNumOccupied();
+        std::cout << "Voxel mesh: " << mesh_stats.num_vertices << " vertices, " << mesh_stats.num_faces << " faces";
+        if (mesh_style_ != MeshStyle::cubes && num_occupied_voxels > 0)
+            std::cout << " (" << 100.0 * mesh_stats.num_vertices / (8 * num_occupied_voxels) << "% / "
+                      << 100.0 * mesh_stats.num_faces / (12 * num_occupied_voxels) << "% of separate cubes)";
+        std::cout << ", written in " << elapsed.count() << " s" << std::endl;
     }
 }
 
+// chunk of coordinate x along one axis, clamped so the outermost chunks
+// extend to infinity. Monotonic in x, so the chunks of a face's bounds
+// enclose the chunks of every point inside them
+static int GetChunkIndex(const float x, const float origin, const float extent, const int num_chunks) {
+    const float chunk = std::floor((x - origin) / extent);
+    return static_cast<int>(std::min(std::max(chunk, 0.0f), static_cast<float>(num_chunks - 1)));
+}
+
+void ClassyVoxelizer::ForEachFaceChunk(const size_t face_i,
+                                       const float chunk_extent,
+                                       const Eigen::Vector3i& num_chunks,
+                                       const std::function<void(const size_t chunk_i)>& function) const {
+    const Eigen::Vector3f margin = Eigen::Vector3f::Constant(voxel_sizes_.back());
+    Eigen::Vector3f face_min = vertices_[faces_[3*face_i]];
+    Eigen::Vector3f face_max = face_min;
+    for (int j = 1; j < 3; j++) {
+        face_min = face_min.cwiseMin(vertices_[faces_[3*face_i+j]]);
+        face_max = face_max.cwiseMax(vertices_[faces_[3*face_i+j]]);
+    }
+    Eigen::Vector3i first, last;
+    for (int i = 0; i < 3; i++) {
+        first[i] = GetChunkIndex(face_min[i] - margin[i], min_[i], chunk_extent, num_chunks[i]);
+        last[i] = GetChunkIndex(face_max[i] + margin[i], min_[i], chunk_extent, num_chunks[i]);
+    }
+    for (int z = first[2]; z <= last[2]; z++) {
+        for (int y = first[1]; y <= last[1]; y++) {
+            for (int x = first[0]; x <= last[0]; x++)
+                function((static_cast<size_t>(z) * num_chunks[1] + y) * num_chunks[0] + x);
+        }
+    }
+}
+
+Eigen::Vector3i ClassyVoxelizer::GetNumChunks(const float chunk_extent) const {
+    Eigen::Vector3i num_chunks;
+    for (int i = 0; i < 3; i++)
+        num_chunks[i] = std::max(1, static_cast<int>(std::ceil((max_[i] - min_[i]) / chunk_extent)));
+    return num_chunks;
+}
+
+// Rough upper bounds for the sparse grids of a chunk: a face stamps up to
+// about 3 voxels per voxel face of its area, and a voxel takes up to 64 bytes
+// at the lowest load of the hash tables, with the sums kept for aggregation
+static const double kVoxelsPerArea = 3.0;
+static const double kBytesPerVoxel = 64.0;
+static const int kMinChunkSize = 16;
+
+int ClassyVoxelizer::GetBudgetChunkSize() const {
+    double bytes_per_area = 0;
+    for (const float voxel_size: voxel_sizes_)
+        bytes_per_area += kVoxelsPerArea * kBytesPerVoxel / (voxel_size * voxel_size);
+    const double budget = memory_budget_mb_ * 1024.0 * 1024.0;
+    const size_t num_faces = faces_.size() / 3;
+    std::vector<float> face_areas(num_faces);
+    for (size_t face_i = 0; face_i < num_faces; face_i++) {
+        const Eigen::Vector3f& a = vertices_[faces_[3*face_i]];
+        face_areas[face_i] = 0.5f * (vertices_[faces_[3*face_i+1]] - a).cross(vertices_[faces_[3*face_i+2]] - a).norm();
+    }
+    
+    // halved from a single chunk over the whole scene until the fullest fits.
+    // Faces count fully in every chunk they overlap, so the estimate only errs
+    // on the large side
+    const float scene_extent = (max_ - min_).maxCoeff();
+    int chunk_size = std::max(kMinChunkSize, static_cast<int>(std::ceil(scene_extent / voxel_sizes_.front())));
+    std::unordered_map<size_t, double> chunk_areas;
+    for (; chunk_size > kMinChunkSize; chunk_size /= 2) {
+        const float chunk_extent = chunk_size * voxel_sizes_.front();
+        const Eigen::Vector3i num_chunks = GetNumChunks(chunk_extent);
+        chunk_areas.clear();
+        double max_area = 0;
+        for (size_t face_i = 0; face_i < num_faces; face_i++) {
+            ForEachFaceChunk(face_i, chunk_extent, num_chunks, [&](const size_t chunk_i) {
+                double& area = chunk_areas[chunk_i];
+                area += face_areas[face_i];
+                max_area = std::max(max_area, area);
+            });
+        }
+        if (max_area * bytes_per_area <= budget)
+            return chunk_size;
+    }
+    std::cerr << "Warning: chunks of " << kMinChunkSize << " voxels may exceed the memory budget of "
+              << memory_budget_mb_ << " MB" << std::endl;
+    return kMinChunkSize;
+}
+
+// Faces are binned into every chunk their bounds overlap, grown by the
+// coarsest voxel size, which covers every voxel centered in the chunk that
+// they can stamp. The grids keep the lattice of the whole scene, so faces
+// straddling chunks are split in each of them exactly as in one pass, and each
+// chunk writes out the voxels centered in it. Chunks are written in order
+// behind a header with a placeholder count, which is rewritten at the end
+template <typename Grid, typename GridVoxelizer, typename Attribute>
+uint64_t ClassyVoxelizer::VoxelizeInChunks(GridVoxelizer& voxelizer,
+                                           const std::vector<Grid*>& voxel_grids,
+                                           const std::vector<Attribute>& vertex_attributes,
+                                           SceneStats& stats) {
+    const std::vector<std::string>& output_files = stats.output_files;
+    StageReport& stages = stats.stages;
+    stages.Start("bin");
+    const int chunk_size = (chunk_size_ > 0) ? chunk_size_ : GetBudgetChunkSize();
+    const float chunk_extent = chunk_size * voxel_sizes_.front();
+    const Eigen::Vector3i num_chunks = GetNumChunks(chunk_extent);
+    stages.AddCount("bin", "chunk_size", chunk_size);
+    const size_t num_chunks_total = static_cast<size_t>(num_chunks[0]) * num_chunks[1] * num_chunks[2];
+    auto get_chunk = [&](const Eigen::Vector3f& point) {
+        return Eigen::Vector3i(GetChunkIndex(point[0], min_[0], chunk_extent, num_chunks[0]),
+                               GetChunkIndex(point[1], min_[1], chunk_extent, num_chunks[1]),
+                               GetChunkIndex(point[2], min_[2], chunk_extent, num_chunks[2]));
+    };
+    
+    // faces of chunk i are chunk_face_ids[chunk_offsets[i], chunk_offsets[i+1])
+    const size_t num_faces = faces_.size() / 3;
+    std::vector<size_t> chunk_offsets(num_chunks_total + 1, 0);
+    for (size_t face_i = 0; face_i < num_faces; face_i++)
+        ForEachFaceChunk(face_i, chunk_extent, num_chunks, [&](const size_t chunk_i) { chunk_offsets[chunk_i + 1]++; });
+    std::partial_sum(chunk_offsets.begin(), chunk_offsets.end(), chunk_offsets.begin());
+    std::vector<uint32_t> chunk_face_ids(chunk_offsets.back());
+    std::vector<size_t> chunk_ends(chunk_offsets.begin(), chunk_offsets.end() - 1);
+    for (size_t face_i = 0; face_i < num_faces; face_i++)
+        ForEachFaceChunk(face_i, chunk_extent, num_chunks, [&](const size_t chunk_i) { chunk_face_ids[chunk_ends[chunk_i]++] = face_i; });
+    if (verbose_) {
+        std::cout << num_chunks[0] << "x" << num_chunks[1] << "x" << num_chunks[2] << " chunks of "
+                  << chunk_size << " voxels" << std::endl;
+    }
+    
+    const size_t num_grids = voxel_grids.size();
+    std::vector<std::unique_ptr<BufferedFileWriter>> outputs(num_grids);
+    // voxel files: runs continue from one chunk to the next
+    std::vector<std::unique_ptr<VoxelRunWriter>> runs(num_grids);
+    auto write_header = [&](const size_t i, const uint64_t num_voxels) {
+        if (output_format_ == VoxelFormat::cvox) {
+            // the grids keep the lattice of the whole scene from chunk to chunk
+            VoxelFileHeader header = voxel_grids[i]->GetVoxelFileHeader();
+            header.num_voxels = num_voxels;
+            header.Write(*outputs[i]);
+        } else {
+            VoxelGridInterface::WritePointCloudHeader(*outputs[i], num_voxels);
+        }
+    };
+    for (size_t i = 0; i < num_grids; i++) {
+        outputs[i].reset(new BufferedFileWriter(output_files[i]));
+        if (!outputs[i]->IsOpen()) {
+            std::cerr << "Error: cannot write " << output_files[i] << std::endl;
+            for (size_t j = 0; j < i; j++) {
+                runs[j].reset();
+                outputs[j].reset();
+                std::remove(output_files[j].c_str());
+            }
+            stats.outputs_written = false;
+            stages.Stop();
+            return 0;
+        }
+        write_header(i, 0);
+        if (output_format_ == VoxelFormat::cvox)
+            runs[i].reset(new VoxelRunWriter(*outputs[i], !voxel_grids[i]->GetVoxelFileHeader().class_colors.empty()));
+    }
+    std::vector<uint64_t> num_written(num_grids, 0);
+    std::vector<uint32_t> chunk_faces;
+    for (size_t chunk_i = 0; chunk_i < num_chunks_total; chunk_i++) {
+        if (chunk_offsets[chunk_i] == chunk_offsets[chunk_i + 1])
+            continue;
+        stages.Start("allocate");
+        chunk_faces.clear();
+        for (size_t j = chunk_offsets[chunk_i]; j < chunk_offsets[chunk_i + 1]; j++) {
+            const auto face = faces_.begin() + 3 * chunk_face_ids[j];
+            chunk_faces.insert(chunk_faces.end(), face, face + 3);
+        }
+        for (size_t i = 0; i < num_grids; i++) {
+            const Eigen::Vector3f padding = Eigen::Vector3f::Constant(voxel_sizes_[i]);
+            voxel_grids[i]->Reset(min_ - padding, max_ + padding, voxel_sizes_[i]);
+        }
+        if (verbose_) {
+            std::cout << "Chunk " << chunk_i + 1 << " of " << num_chunks_total << ", "
+                      << chunk_faces.size() / 3 << " faces: " << std::flush;
+        }
+        stages.Start("voxelize");
+        voxelizer.Voxelize(voxel_grids, vertices_, chunk_faces, vertex_attributes);
+        
+        stages.Start("save");
+        const uint64_t num_written_before = num_written[0];
+        const Eigen::Vector3i chunk(chunk_i % num_chunks[0],
+                                    (chunk_i / num_chunks[0]) % num_chunks[1],
+                                    chunk_i / (static_cast<size_t>(num_chunks[0]) * num_chunks[1]));
+        auto in_chunk = [&](const Eigen::Vector3f& center) { return get_chunk(center) == chunk; };
+        for (size_t i = 0; i < num_grids; i++) {
+            if (runs[i])
+                num_written[i] += voxel_grids[i]->AppendVoxelRuns(*runs[i], in_chunk);
+            else
+                num_written[i] += voxel_grids[i]->AppendPointCloud(*outputs[i], in_chunk);
+        }
+        // voxels of the chunk only, not those stamped from faces crossing it
+        const uint64_t num_occupied = num_written[0] - num_written_before;
+        AddVoxelizeCounts(stages, voxelizer.GetStats(), num_occupied);
+    }
+    
+    stages.Start("save");
+    for (size_t i = 0; i < num_grids; i++) {
+        if (runs[i])
+            runs[i]->Flush();
+        runs[i].reset();
+        // the header has the same size with the final count
+        outputs[i]->Rewind();
+        write_header(i, num_written[i]);
+        const bool written = outputs[i]->Close();
+        outputs[i].reset();
+        if (!written) {
+            std::cerr << "Error: could not write all of " << output_files[i] << std::endl;
+            stats.outputs_written = false;
+        }
+    }
+    stages.Stop();
+    return num_written[0];
+}
+
 int ClassyVoxelizer::ReadPly(const std::string& filepath) {
+    if (mapped_input_) {
+        // binary bodies are decoded straight out of the mapping, without going
+        // through stream buffers. Decoded pages are dropped as decoding moves on
+        MappedFile mapped_file(filepath);
+        const char* data = mapped_file.GetData();
+        const char* data_end = data + mapped_file.GetSize();
+        const std::string end_header("end_header");
+        const char* body = mapped_file.IsOpen() ? std::search(data, data_end, end_header.begin(), end_header.end()) : data_end;
+        body = std::find(body, data_end, '\n');
+        if (body != data_end) {
+            body++;
+            std::istringstream header(std::string(data, body));
+            tinyply::PlyFile input_file(header);
+            if (input_file.is_binary()) {
+                std::vector<uint8_t> raw_colors;
+                const uint32_t num_vertices = RequestPlyProperties(input_file, raw_colors);
+                input_file.read(body, data_end - body, [&](const char* end) { mapped_file.Release(end); });
+                return StorePlyProperties(num_vertices, raw_colors);
+            }
+        }
+    }
     std::ifstream ss(filepath, std::ios::binary);
     tinyply::PlyFile input_file(ss);
-    std::vector<float> raw_vertices;
     std::vector<uint8_t> raw_colors;
-    std::vector<uint16_t> raw_labels;
-    
-    const uint32_t num_vertices = input_file.request_properties_from_element("vertex", { "x", "y", "z" }, raw_vertices);
+    const uint32_t num_vertices = RequestPlyProperties(input_file, raw_colors);
+    input_file.read(ss);
+    return StorePlyProperties(num_vertices, raw_colors);
+}
+
+uint32_t ClassyVoxelizer::RequestPlyProperties(tinyply::PlyFile& input_file, std::vector<uint8_t>& raw_colors) {
+    // positions, labels and faces are decoded straight into the voxelizer's
+    // arrays, Eigen::Vector3f holds its three floats contiguously
+    static_assert(sizeof(Eigen::Vector3f) == 3 * sizeof(float), "Eigen::Vector3f is not packed");
+    vertices_.resize(input_file.get_element_size("vertex"));
+    const uint32_t num_vertices = input_file.request_properties_from_element("vertex", { "x", "y", "z" }, reinterpret_cast<float*>(vertices_.data()));
     input_file.request_properties_from_element("vertex", { "red", "green", "blue" }, raw_colors);
-    input_file.request_properties_from_element("vertex", { "label" }, raw_labels);
+    input_file.request_properties_from_element("vertex", { "label" }, vertex_labels_);
     input_file.request_properties_from_element("face", { "vertex_indices" }, faces_, 3);
+    return num_vertices;
+}
 
-    input_file.read(ss);
-    
+int ClassyVoxelizer::StorePlyProperties(const uint32_t num_vertices, const std::vector<uint8_t>& raw_colors) {
     vertices_.resize(num_vertices);
-    colors_.resize(num_vertices);
-    if (raw_labels.size() == num_vertices)
-        vertex_labels_.resize(num_vertices);
-    
-    int raw_vertices_i = 0;
-    int raw_colors_i = 0;
-    for (int i = 0; i < num_vertices; i++) {
-        vertices_[i][0] = raw_vertices[raw_vertices_i++];
-        vertices_[i][1] = raw_vertices[raw_vertices_i++];
-        vertices_[i][2] = raw_vertices[raw_vertices_i++];
-        colors_[i][0] = raw_colors[raw_colors_i++];
-        colors_[i][1] = raw_colors[raw_colors_i++];
-        colors_[i][2] = raw_colors[raw_colors_i++];
-        if (raw_labels.size() == num_vertices)
-            vertex_labels_[i] = raw_labels[i];
-    }
+    colors_.resize(num_vertices, Eigen::Vector3i::Zero());
+    if (vertex_labels_.size() != num_vertices)
+        vertex_labels_.clear();
+    for (size_t i = 0; i < raw_colors.size() / 3; i++)
+        colors_[i] << raw_colors[3*i], raw_colors[3*i+1], raw_colors[3*i+2];
     return num_vertices;
 }
 
-// create map with unique colors in the scene
+// 24-bit RGB key of the color lookups
+static uint32_t PackColor(const Eigen::Vector3i& color) {
+    return (color[0] & 0xFF) << 16 | (color[1] & 0xFF) << 8 | (color[2] & 0xFF);
+}
+
+// create map with unique colors in the scene. Class 0 marks empty voxels, so
+// classes start at 1 and index the colormap directly
 bool ClassyVoxelizer::CreateColorMap(const std::vector<Eigen::Vector3i>& colors,
-                                     std::vector<Eigen::Vector3i>& colormap) {
+                                     std::vector<Eigen::Vector3i>& colormap,
+                                     std::unordered_map<uint32_t, uint16_t>& color_classes) {
+    colormap.assign(1, Eigen::Vector3i::Zero());
     for (const auto& color: colors) {
-        if (std::find(colormap.begin(), colormap.end(), color) == colormap.end())
+        if (color_classes.emplace(PackColor(color), colormap.size()).second)
             colormap.push_back(color);
     }
-    if (colormap.size() > 255) {
+    if (colormap.size() - 1 > 255) {
         std::cerr << "Error: ClassyVoxelizer only supports up to 255 classes." << std::endl;
         return false;
     }
@@ -119,21 +608,25 @@ bool ClassyVoxelizer::ComputeColorFromLabel(std::vector<uint16_t>& labels,
     colormap_.resize(num_labels);
     std::fill(colormap_.begin(), colormap_.end(), Eigen::Vector3i(250, 0, 0));
     
-    std::vector<uint16_t> labelmap;
+    // labels are 16-bit, so seen labels are flagged directly
+    std::vector<bool> label_seen(1 << 16, false);
+    size_t num_seen_labels = 0;
     for (int i = 0; i < colors_.size(); i++) {
-        if (std::find(labelmap.begin(), labelmap.end(), labels[i]) == labelmap.end()) {
+        if (!label_seen[labels[i]]) {
             // new label found
             const int label = labels[i];
-            labelmap.push_back(label);
-            if (label > colormap_.size()) {
-                std::cout << "skip label in ply (index above threshold)." << std::endl;
+            label_seen[label] = true;
+            num_seen_labels++;
+            if (label >= colormap_.size()) {
+                if (verbose_)
+                    std::cout << "skip label in ply (index above threshold)." << std::endl;
                 continue;
             }
             colormap_[label] = colors_[i];
         }
     }
     // map of labels
-    if (labelmap.size() > 255) {
+    if (num_seen_labels > 255) {
         std::cerr << "Error: ClassyVoxelizer only supports up to 255 classes." << std::endl;
         return false;
     }
@@ -142,22 +635,16 @@ bool ClassyVoxelizer::ComputeColorFromLabel(std::vector<uint16_t>& labels,
 
 bool ClassyVoxelizer::ComputeClassFromColor(std::vector<uint16_t>& classes) {
     classes.resize(colors_.size());
-    CreateColorMap(colors_, colormap_);
+    std::unordered_map<uint32_t, uint16_t> color_classes;
+    CreateColorMap(colors_, colormap_, color_classes);
     
-    int vertex_class_i = 0;
-    for (const auto& color: colors_) {
-        int class_i;
-        for (class_i = 0; class_i < colormap_.size(); class_i++) {
-            if (colormap_[class_i] == color) {
-                break;
-            }
-        }
-        classes[vertex_class_i++] = class_i+1;
-    }
+    for (size_t i = 0; i < colors_.size(); i++)
+        classes[i] = color_classes[PackColor(colors_[i])];
     return true;
 }
 
-void ClassyVoxelizer::GetVoxelSpaceDimensions(const double voxel_size) {
+// bounds of the input vertices, without padding
+void ClassyVoxelizer::GetVoxelSpaceDimensions() {
     Eigen::Vector3f centroid(0,0,0);
     
     for (const Eigen::Vector3f& vertex: vertices_)
@@ -186,7 +673,17 @@ void ClassyVoxelizer::GetVoxelSpaceDimensions(const double voxel_size) {
         if ((vertex[2] - centroid[2]) < (min_[2] - centroid[2]))
             min_[2] = vertex[2];
     }
-    
-    max_ += Eigen::Vector3f(voxel_size_, voxel_size_, voxel_size_);
-    min_ -= Eigen::Vector3f(voxel_size_, voxel_size_, voxel_size_);
+}
+
+std::string ClassyVoxelizer::GetOutputPath(const std::string& filepath, const float voxel_size) const {
+    if (voxel_sizes_.size() == 1 || filepath.empty())
+        return filepath;
+    std::ostringstream suffix;
+    suffix << "_" << voxel_size;
+    for (const std::string extension: {".ply", ".cvox"}) {
+        if (filepath.size() >= extension.size() &&
+            filepath.compare(filepath.size() - extension.size(), extension.size(), extension) == 0)
+            return filepath.substr(0, filepath.size() - extension.size()) + suffix.str() + extension;
+    }
+    return filepath + suffix.str();
 }
@@ -7,41 +7,137 @@
  */
 
 #include "ColoredVoxelGrid.h"
+#include "VoxelGridExport.h"
+
+// 0x1RRGGBB, bit 24 marks the voxel occupied so black voxels aren't empty
+static uint32_t PackColor(const Eigen::Vector3i& color) {
+    return 1 << 24 | (color[0] & 0xFF) << 16 | (color[1] & 0xFF) << 8 | (color[2] & 0xFF);
+}
+
+static Eigen::Vector3i UnpackColor(const uint32_t packed) {
+    return Eigen::Vector3i((packed >> 16) & 0xFF, (packed >> 8) & 0xFF, packed & 0xFF);
+}
 
 ColoredVoxelGrid::ColoredVoxelGrid(const Eigen::Vector3f& grid_min,
                                    const Eigen::Vector3f& grid_max,
-                                   float voxel_size):
-    VoxelGridInterface(grid_min, grid_max, voxel_size), empty_voxel_(-1,-1,-1) {
-    voxel_grid_.resize(num_voxels_, empty_voxel_);
+                                   float voxel_size,
+                                   const VoxelStorage storage):
+    VoxelGrid<ColoredVoxelGrid>(grid_min, grid_max, voxel_size, storage),
+    voxel_grid_((storage == VoxelStorage::atomic) ? 0 : num_voxels_, 0,
+                (storage == VoxelStorage::atomic) ? VoxelStorage::dense : storage),
+    color_sums_(0, ColorSum::Zero(), VoxelStorage::sparse),
+    empty_voxel_(-1,-1,-1) {
+    ResetAtomicStorage();
 }
 
-bool ColoredVoxelGrid::IsVoxelOccupied(uint32_t voxel_id) const {
-	return voxel_grid_[voxel_id][0] != empty_voxel_[0] ||
-           voxel_grid_[voxel_id][1] != empty_voxel_[1] ||
-           voxel_grid_[voxel_id][2] != empty_voxel_[2];
+void ColoredVoxelGrid::Reset(const Eigen::Vector3f& grid_min, const Eigen::Vector3f& grid_max, const float voxel_size) {
+    SetBounds(grid_min, grid_max, voxel_size);
+    voxel_grid_.Reset(SupportsConcurrentWrites() ? 0 : num_voxels_);
+    color_sums_.Reset(0);
+    ResetAtomicStorage();
 }
 
-void ColoredVoxelGrid::SetVoxelColor(const uint32_t voxel_id, const Eigen::Vector3i& color) {
-    if (voxel_id < num_voxels_)
-        voxel_grid_[voxel_id] = color;
+void ColoredVoxelGrid::SetAggregation(const VoxelAggregation aggregation) {
+    if (aggregation == aggregation_)
+        return;
+    aggregation_ = aggregation;
+    ResetAtomicStorage();
+}
+
+// only the arrays of the current aggregation are allocated
+void ColoredVoxelGrid::ResetAtomicStorage() {
+    const bool atomic = SupportsConcurrentWrites();
+    const bool majority = (aggregation_ == VoxelAggregation::majority);
+    atomic_colors_.Reset((atomic && !majority) ? num_voxels_ : 0);
+    atomic_red_green_.Reset((atomic && majority) ? num_voxels_ : 0);
+    atomic_blue_count_.Reset((atomic && majority) ? num_voxels_ : 0);
+}
+
+bool ColoredVoxelGrid::IsVoxelOccupied(VoxelID voxel_id) const {
+    if (SupportsConcurrentWrites()) {
+        if (aggregation_ == VoxelAggregation::last)
+            return atomic_colors_.Get(voxel_id) != 0;
+        return (atomic_blue_count_.Get(voxel_id) & 0xFFFFFFFF) != 0;
+    }
+    return voxel_grid_.IsOccupied(voxel_id);
 }
 
-const Eigen::Vector3i& ColoredVoxelGrid::GetVoxelColor(const uint32_t voxel_id) const {
-    if (voxel_id < num_voxels_)
-        return voxel_grid_[voxel_id];
-    return empty_voxel_;
+void ColoredVoxelGrid::SetVoxelColor(const VoxelID voxel_id, const Eigen::Vector3i& color) {
+    if (voxel_id >= num_voxels_)
+        return;
+    if (SupportsConcurrentWrites()) {
+        if (aggregation_ == VoxelAggregation::last) {
+            atomic_colors_.CountOccupied(atomic_colors_.Exchange(voxel_id, PackColor(color)) != 0, true);
+        } else {
+            atomic_red_green_.FetchAdd(voxel_id, uint64_t(color[0] & 0xFF) << 32 | (color[1] & 0xFF));
+            const uint64_t previous = atomic_blue_count_.FetchAdd(voxel_id, uint64_t(color[2] & 0xFF) << 32 | 1);
+            atomic_blue_count_.CountOccupied((previous & 0xFFFFFFFF) != 0, true);
+        }
+        return;
+    }
+    if (aggregation_ == VoxelAggregation::last) {
+        voxel_grid_.Set(voxel_id, PackColor(color));
+        return;
+    }
+    ColorSum sum = color_sums_.Get(voxel_id);
+    sum.head<3>() += color.cast<uint32_t>();
+    sum[3]++;
+    color_sums_.Set(voxel_id, sum);
+    voxel_grid_.Set(voxel_id, PackColor(((sum.head<3>().array() + sum[3] / 2) / sum[3]).cast<int>()));
 }
 
-unsigned int ColoredVoxelGrid::GetNumOccupiedVoxels() const {
-    unsigned int num_occupied_voxels = 0;
-    for (const auto& voxel: voxel_grid_) {
-        if (voxel != Eigen::Vector3i(-1, -1, -1))
-            num_occupied_voxels++;
+Eigen::Vector3i ColoredVoxelGrid::GetVoxelColor(const VoxelID voxel_id) const {
+    if (voxel_id >= num_voxels_)
+        return empty_voxel_;
+    if (!SupportsConcurrentWrites() || aggregation_ == VoxelAggregation::last) {
+        const uint32_t packed = SupportsConcurrentWrites() ? atomic_colors_.Get(voxel_id) : voxel_grid_.Get(voxel_id);
+        return (packed == 0) ? empty_voxel_ : UnpackColor(packed);
     }
-    return num_occupied_voxels;
+    const uint64_t red_green = atomic_red_green_.Get(voxel_id);
+    const uint64_t blue_count = atomic_blue_count_.Get(voxel_id);
+    const uint64_t count = blue_count & 0xFFFFFFFF;
+    if (count == 0)
+        return empty_voxel_;
+    return Eigen::Vector3i(((red_green >> 32) + count / 2) / count,
+                           ((red_green & 0xFFFFFFFF) + count / 2) / count,
+                           ((blue_count >> 32) + count / 2) / count);
+}
+
+uint64_t ColoredVoxelGrid::GetNumOccupiedVoxels() const {
+    if (!SupportsConcurrentWrites())
+        return voxel_grid_.GetNumOccupied();
+    if (aggregation_ == VoxelAggregation::last)
+        return atomic_colors_.GetNumOccupied();
+    return atomic_blue_count_.GetNumOccupied();
 }
 
 void ColoredVoxelGrid::SetVoxelColor(const Eigen::Vector3f& vertex, const Eigen::Vector3i& color) {
-    const uint32_t voxel_id = GetEnclosingVoxelID(vertex);
+    const VoxelID voxel_id = GetEnclosingVoxelID(vertex);
     SetVoxelColor(voxel_id, color);
 }
+
+template <typename Function>
+void ColoredVoxelGrid::ForEachOccupiedVoxel(const Function& function) const {
+    if (SupportsConcurrentWrites()) {
+        auto visit = [&](const VoxelID voxel_id, const uint64_t) { function(voxel_id, GetVoxel(voxel_id)); };
+        if (aggregation_ == VoxelAggregation::last)
+            atomic_colors_.ForEachNonZero(visit);
+        else
+            atomic_blue_count_.ForEachNonZero(visit);
+        return;
+    }
+    if (!voxel_grid_.IsSparse()) {
+        voxel_grid_.ForEachOccupied([&](const VoxelID voxel_id, const uint32_t) {
+            function(voxel_id, GetVoxel(voxel_id));
+        });
+        return;
+    }
+    std::vector<VoxelID> voxel_ids;
+    voxel_ids.reserve(voxel_grid_.GetNumOccupied());
+    voxel_grid_.ForEachOccupied([&](const VoxelID voxel_id, const uint32_t) {
+        voxel_ids.push_back(voxel_id);
+    });
+    ForEachVoxelID(voxel_ids, function);
+}
+
+template class VoxelGrid<ColoredVoxelGrid>;
@@ -8,42 +8,201 @@
 
 #include "ColoredVoxelizer.h"
 
+#include <algorithm>
+
 void ColoredVoxelizer::Voxelize(ColoredVoxelGrid& voxel_grid,
-                                std::vector<Eigen::Vector3f>& vertices,
-                                std::vector<uint32_t> &faces,
-                                std::vector<Eigen::Vector3i> &colors) {
-    std::vector<uint32_t> split_faces;
-    const int ten_percent_step = faces.size() / 10;
-    std::vector<uint32_t> face(3);
+                                const std::vector<Eigen::Vector3f>& vertices,
+                                const std::vector<uint32_t>& faces,
+                                const std::vector<Eigen::Vector3i>& colors) {
+    Voxelize(std::vector<ColoredVoxelGrid*>(1, &voxel_grid), vertices, faces, colors);
+}
+
+void ColoredVoxelizer::Voxelize(const std::vector<ColoredVoxelGrid*>& voxel_grids,
+                                const std::vector<Eigen::Vector3f>& vertices,
+                                const std::vector<uint32_t>& faces,
+                                const std::vector<Eigen::Vector3i>& colors) {
+    stats_ = VoxelizeStats();
+    if (method_ == VoxelizationMethod::raster) {
+        for (const auto& voxel_grid: voxel_grids)
+            VoxelizeRaster(*voxel_grid, vertices, faces, colors);
+        return;
+    }
+    if (CanStampConcurrently(voxel_grids)) {
+        VoxelizeConcurrent(voxel_grids, vertices, faces, colors);
+        return;
+    }
+    if (num_threads_ > 1) {
+        VoxelizeParallel(voxel_grids, vertices, faces, colors);
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    ScratchArray<Eigen::Vector3f> scratch_vertices(vertices);
+    ScratchArray<Eigen::Vector3i> scratch_colors(colors);
+    std::vector<SplitTask> stack;
+    const int ten_percent_step = std::max<int>(faces.size() / 10, 1);
     for (int i = 0; i < faces.size(); i+=3) {
-        face[0] = faces[i];
-        face[1] = faces[i+1];
-        face[2] = faces[i+2];
-		std::vector<uint32_t> sub_faces;
-		SplitFace(voxel_grid, vertices, colors, face, sub_faces);
-        split_faces.insert(split_faces.end(), sub_faces.begin(), sub_faces.end());
-        if ((i % ten_percent_step == 0 || (i-1) % ten_percent_step == 0 || (i-2) % ten_percent_step == 0) && i != 0)
+        const Face face = {{ faces[i], faces[i+1], faces[i+2] }};
+        SplitAndStampFace(voxel_grids, scratch_vertices, scratch_colors, face, stack, stats_);
+        if (verbose_ && (i % ten_percent_step == 0 || (i-1) % ten_percent_step == 0 || (i-2) % ten_percent_step == 0) && i != 0)
             std::cout << i / ten_percent_step << "0% " << std::flush;
     }
-    for (const auto& split_face_vertex_i: split_faces) {
-        voxel_grid.SetVoxelColor(vertices[split_face_vertex_i], colors[split_face_vertex_i]);
+    if (verbose_)
+        std::cout << "100%" << std::endl;
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    stats_.split_seconds = elapsed.count() - stats_.stamp_seconds;
+}
+
+void ColoredVoxelizer::SplitAndStampFace(const std::vector<ColoredVoxelGrid*>& voxel_grids,
+                                         ScratchArray<Eigen::Vector3f>& vertices,
+                                         ScratchArray<Eigen::Vector3i>& colors,
+                                         const Face& face,
+                                         std::vector<SplitTask>& stack,
+                                         VoxelizeStats& stats) {
+    SubdivideFace(*voxel_grids[0], vertices, face, stack,
+                  [&](const Face& split_face, const int longest_i) {
+                      stats.num_midpoints++;
+                      colors.push_back((colors[split_face[longest_i % 3]] + colors[split_face[(longest_i + 1) % 3]]) / 2);
+                  },
+                  [&](const Face& leaf_face) {
+                      StampLeaf(stats, [&]() {
+                          const Eigen::Vector3f corners[3] = { vertices[leaf_face[0]], vertices[leaf_face[1]], vertices[leaf_face[2]] };
+                          VoxelID voxel_ids[3];
+                          for (const auto& voxel_grid: voxel_grids) {
+                              voxel_grid->GetEnclosingVoxelIDs(corners, 3, voxel_ids);
+                              for (int i = 0; i < 3; i++)
+                                  voxel_grid->SetVoxelColor(voxel_ids[i], colors[leaf_face[i]]);
+                          }
+                      });
+                  },
+                  [&]() {
+                      vertices.pop_back();
+                      colors.pop_back();
+                  });
+}
+
+void ColoredVoxelizer::SplitFace(const ColoredVoxelGrid& voxel_grid,
+                                 ScratchArray<Eigen::Vector3f>& vertices,
+                                 ScratchArray<Eigen::Vector3i>& colors,
+                                 const Face& face,
+                                 std::vector<SplitTask>& stack,
+                                 std::vector<uint32_t>& sub_faces) const {
+    SubdivideFace(voxel_grid, vertices, face, stack,
+                  [&](const Face& split_face, const int longest_i) {
+                      colors.push_back((colors[split_face[longest_i % 3]] + colors[split_face[(longest_i + 1) % 3]]) / 2);
+                  },
+                  [&](const Face& leaf_face) {
+                      sub_faces.insert(sub_faces.end(), leaf_face.begin(), leaf_face.end());
+                  },
+                  []() {});
+}
+
+void ColoredVoxelizer::VoxelizeParallel(const std::vector<ColoredVoxelGrid*>& voxel_grids,
+                                        const std::vector<Eigen::Vector3f>& vertices,
+                                        const std::vector<uint32_t>& faces,
+                                        const std::vector<Eigen::Vector3i>& colors) {
+    const ColoredVoxelGrid& finest_grid = *voxel_grids[0];
+    const size_t num_grids = voxel_grids.size();
+    const size_t num_chunks = GetNumFaceChunks(faces.size() / 3);
+    std::vector<std::vector<Eigen::Vector3i>> chunk_colors(num_chunks);
+    std::vector<std::vector<uint32_t>> chunk_sub_faces(num_chunks);
+    std::vector<std::vector<VoxelID>> chunk_voxel_ids(num_chunks);
+    
+    stats_.split_seconds = ForEachFaceChunk(faces.size() / 3, [&](const size_t chunk_i, const size_t first_face, const size_t last_face) {
+        ScratchArray<Eigen::Vector3f> scratch_vertices(vertices);
+        ScratchArray<Eigen::Vector3i> scratch_colors(colors);
+        std::vector<uint32_t>& sub_faces = chunk_sub_faces[chunk_i];
+        std::vector<SplitTask> stack;
+        for (size_t i = 3 * first_face; i < 3 * last_face; i+=3) {
+            const Face face = {{ faces[i], faces[i+1], faces[i+2] }};
+            SplitFace(finest_grid, scratch_vertices, scratch_colors, face, stack, sub_faces);
+        }
+        // voxel ids of all grids per sub-face vertex
+        AppendSubFaceVoxelIDs(voxel_grids, scratch_vertices, sub_faces, chunk_voxel_ids[chunk_i]);
+        chunk_colors[chunk_i] = scratch_colors.local();
+    });
+    
+    // merge in face order so the last-write-wins stamping matches the serial
+    // path exactly. Colors of the midpoints of a chunk follow the input
+    const size_t num_shared = colors.size();
+    const auto merge_start = std::chrono::steady_clock::now();
+    for (size_t chunk_i = 0; chunk_i < num_chunks; chunk_i++) {
+        stats_.num_midpoints += chunk_colors[chunk_i].size();
+        stats_.num_sub_faces += chunk_sub_faces[chunk_i].size() / 3;
+        const std::vector<Eigen::Vector3i>& midpoint_colors = chunk_colors[chunk_i];
+        auto get_color = [&](const uint32_t i) -> const Eigen::Vector3i& {
+            return (i < num_shared) ? colors[i] : midpoint_colors[i - num_shared];
+        };
+        const std::vector<uint32_t>& sub_faces = chunk_sub_faces[chunk_i];
+        const std::vector<VoxelID>& voxel_ids = chunk_voxel_ids[chunk_i];
+        for (size_t j = 0; j < sub_faces.size(); j++) {
+            for (size_t grid_i = 0; grid_i < num_grids; grid_i++)
+                voxel_grids[grid_i]->SetVoxelColor(voxel_ids[num_grids * j + grid_i], get_color(sub_faces[j]));
+        }
+        std::vector<Eigen::Vector3i>().swap(chunk_colors[chunk_i]);
+        std::vector<uint32_t>().swap(chunk_sub_faces[chunk_i]);
+        std::vector<VoxelID>().swap(chunk_voxel_ids[chunk_i]);
     }
-    std::cout << "100%" << std::endl;
+    const std::chrono::duration<double> merge_elapsed = std::chrono::steady_clock::now() - merge_start;
+    stats_.stamp_seconds = merge_elapsed.count();
+    if (verbose_)
+        std::cout << "100%" << std::endl;
 }
 
-void ColoredVoxelizer::SplitFace(ColoredVoxelGrid& voxel_grid,
-                                 std::vector<Eigen::Vector3f>& vertices,
-                                 std::vector<Eigen::Vector3i>& colors,
-                                 std::vector<uint32_t>& face,
-                                 std::vector<uint32_t>& sub_faces) {
-    std::vector<uint32_t> first_sub_face(3);
-    std::vector<uint32_t> second_sub_face(3);
-    const int longest_i = SplitBaseFace(voxel_grid, vertices, face, sub_faces,
-                                        first_sub_face, second_sub_face);
-    if (longest_i == -1)
-        return;
+void ColoredVoxelizer::VoxelizeConcurrent(const std::vector<ColoredVoxelGrid*>& voxel_grids,
+                                          const std::vector<Eigen::Vector3f>& vertices,
+                                          const std::vector<uint32_t>& faces,
+                                          const std::vector<Eigen::Vector3i>& colors) {
+    std::vector<VoxelizeStats> chunk_stats(GetNumFaceChunks(faces.size() / 3));
+    const double seconds = ForEachFaceChunk(faces.size() / 3, [&](const size_t chunk_i, const size_t first_face, const size_t last_face) {
+        ScratchArray<Eigen::Vector3f> scratch_vertices(vertices);
+        ScratchArray<Eigen::Vector3i> scratch_colors(colors);
+        std::vector<SplitTask> stack;
+        for (size_t i = 3 * first_face; i < 3 * last_face; i+=3) {
+            const Face face = {{ faces[i], faces[i+1], faces[i+2] }};
+            SplitAndStampFace(voxel_grids, scratch_vertices, scratch_colors, face, stack, chunk_stats[chunk_i]);
+        }
+    });
+    for (const auto& stats: chunk_stats)
+        stats_ += stats;
+    stats_.split_seconds = seconds - stats_.stamp_seconds;
+    if (verbose_)
+        std::cout << "100%" << std::endl;
+}
+
+void ColoredVoxelizer::VoxelizeRaster(ColoredVoxelGrid& voxel_grid,
+                                      const std::vector<Eigen::Vector3f>& vertices,
+                                      const std::vector<uint32_t>& faces,
+                                      const std::vector<Eigen::Vector3i>& colors) {
+    const size_t num_chunks = GetNumFaceChunks(faces.size() / 3);
+    std::vector<std::vector<VoxelID>> chunk_voxel_ids(num_chunks);
+    std::vector<std::vector<Eigen::Vector3i>> chunk_colors(num_chunks);
+    const bool concurrent = CanStampConcurrently(std::vector<ColoredVoxelGrid*>(1, &voxel_grid));
     
-	colors.push_back((colors[face[longest_i % 3]] + colors[face[(longest_i + 1) % 3]]) / 2);
-    SplitFace(voxel_grid, vertices, colors, first_sub_face, sub_faces);
-    SplitFace(voxel_grid, vertices, colors, second_sub_face, sub_faces);
+    stats_.split_seconds += ForEachFaceChunk(faces.size() / 3, [&](const size_t chunk_i, const size_t first_face, const size_t last_face) {
+        std::vector<VoxelSample> samples;
+        for (size_t i = 3 * first_face; i < 3 * last_face; i+=3) {
+            RasterizeFace(voxel_grid, vertices[faces[i]], vertices[faces[i+1]], vertices[faces[i+2]], samples);
+            for (const auto& sample: samples) {
+                const Eigen::Vector3f color = sample.barycentric[0] * colors[faces[i]].cast<float>() +
+                                              sample.barycentric[1] * colors[faces[i+1]].cast<float>() +
+                                              sample.barycentric[2] * colors[faces[i+2]].cast<float>();
+                if (concurrent) {
+                    voxel_grid.SetVoxelColor(sample.voxel_id, color.array().round().cast<int>().matrix());
+                    continue;
+                }
+                chunk_voxel_ids[chunk_i].push_back(sample.voxel_id);
+                chunk_colors[chunk_i].push_back(color.array().round().cast<int>());
+            }
+        }
+    });
+    
+    const auto merge_start = std::chrono::steady_clock::now();
+    for (size_t chunk_i = 0; chunk_i < num_chunks; chunk_i++) {
+        for (size_t j = 0; j < chunk_voxel_ids[chunk_i].size(); j++)
+            voxel_grid.SetVoxelColor(chunk_voxel_ids[chunk_i][j], chunk_colors[chunk_i][j]);
+    }
+    const std::chrono::duration<double> merge_elapsed = std::chrono::steady_clock::now() - merge_start;
+    stats_.stamp_seconds += merge_elapsed.count();
+    if (verbose_)
+        std::cout << "100%" << std::endl;
 }
@@ -0,0 +1,55 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#include "MappedFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& filepath) {
+    const int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+        void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            // decoded front to back once
+            madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(data);
+            size_ = file_stat.st_size;
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr)
+        munmap(const_cast<char*>(data_), size_);
+}
+
+bool MappedFile::IsOpen() const {
+    return data_ != nullptr;
+}
+
+const char* MappedFile::GetData() const {
+    return data_;
+}
+
+size_t MappedFile::GetSize() const {
+    return size_;
+}
+
+void MappedFile::Release(const char* end) const {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t length = (end - data_) / page_size * page_size;
+    if (data_ != nullptr && length > 0)
+        madvise(const_cast<char*>(data_), length, MADV_DONTNEED);
+}
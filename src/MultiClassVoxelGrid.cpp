@@ -7,41 +7,178 @@
  */
 
 #include "MultiClassVoxelGrid.h"
+#include "VoxelGridExport.h"
+
+// Majority votes of a voxel, packed into a word of 8 bytes whatever the number
+// of classes, which atomic storage updates with one compare-and-swap: three
+// slots of an 8-bit class and a 13-bit count, a count of zero marks a free
+// slot. Exact as long as a voxel sees at most three classes and 8191 samples
+// of one class. Beyond that the rarest class is evicted or all counts are
+// halved, and the result may depend on order. Serial and atomic storage keep
+// the same record, so they agree wherever it is exact.
+static const int kVoteSlots = 3;
+static const int kVoteSlotBits = 21;
+static const uint64_t kMaxVoteCount = (1 << 13) - 1;
+
+static uint8_t GetVoteClass(const uint64_t votes, const int slot) {
+    return (votes >> (kVoteSlotBits * slot)) & 0xFF;
+}
+
+static uint64_t GetVoteCount(const uint64_t votes, const int slot) {
+    return (votes >> (kVoteSlotBits * slot + 8)) & kMaxVoteCount;
+}
+
+static uint64_t SetVote(const uint64_t votes, const int slot, const uint8_t class_i, const uint64_t count) {
+    const uint64_t slot_mask = (uint64_t(1) << kVoteSlotBits) - 1;
+    return (votes & ~(slot_mask << (kVoteSlotBits * slot))) | ((count << 8 | class_i) << (kVoteSlotBits * slot));
+}
+
+static uint64_t AddVote(uint64_t votes, const uint8_t class_i) {
+    int free_slot = -1;
+    int rarest_slot = 0;
+    for (int slot = 0; slot < kVoteSlots; slot++) {
+        const uint64_t count = GetVoteCount(votes, slot);
+        if (count > 0 && GetVoteClass(votes, slot) == class_i) {
+            if (count < kMaxVoteCount)
+                return votes + (uint64_t(1) << (kVoteSlotBits * slot + 8));
+            for (int other = 0; other < kVoteSlots; other++)
+                votes = SetVote(votes, other, GetVoteClass(votes, other), GetVoteCount(votes, other) / 2);
+            return SetVote(votes, slot, class_i, count / 2 + 1);
+        }
+        if (count == 0 && free_slot == -1)
+            free_slot = slot;
+        if (count < GetVoteCount(votes, rarest_slot))
+            rarest_slot = slot;
+    }
+    return SetVote(votes, (free_slot != -1) ? free_slot : rarest_slot, class_i, 1);
+}
+
+// most voted class, ties going to the lower class. Class 0 is empty
+static uint8_t GetMajorityVote(const uint64_t votes) {
+    uint8_t majority = 0;
+    uint64_t majority_count = 0;
+    for (int slot = 0; slot < kVoteSlots; slot++) {
+        const uint64_t count = GetVoteCount(votes, slot);
+        const uint8_t class_i = GetVoteClass(votes, slot);
+        if (count > majority_count || (count == majority_count && count > 0 && class_i < majority)) {
+            majority = class_i;
+            majority_count = count;
+        }
+    }
+    return majority;
+}
 
 MultiClassVoxelGrid::MultiClassVoxelGrid(const Eigen::Vector3f& grid_min,
-                                         const Eigen::Vector3f& grid_max, float voxel_size):
-    VoxelGridInterface(grid_min, grid_max, voxel_size) {
-    voxel_grid_.resize(num_voxels_, 0);
+                                         const Eigen::Vector3f& grid_max, float voxel_size,
+                                         const VoxelStorage storage):
+    VoxelGrid<MultiClassVoxelGrid>(grid_min, grid_max, voxel_size, storage),
+    voxel_grid_((storage == VoxelStorage::atomic) ? 0 : num_voxels_, 0,
+                (storage == VoxelStorage::atomic) ? VoxelStorage::dense : storage),
+    votes_(0, 0, (storage == VoxelStorage::atomic) ? VoxelStorage::dense : storage) {
+    ResetAggregationStorage();
 }
 
-bool MultiClassVoxelGrid::IsVoxelOccupied(const uint32_t voxel_id) const {
-	return voxel_grid_[voxel_id] != 0;
+void MultiClassVoxelGrid::Reset(const Eigen::Vector3f& grid_min, const Eigen::Vector3f& grid_max, const float voxel_size) {
+    SetBounds(grid_min, grid_max, voxel_size);
+    voxel_grid_.Reset(SupportsConcurrentWrites() ? 0 : num_voxels_);
+    ResetAggregationStorage();
 }
 
-void MultiClassVoxelGrid::SetVoxelClass(const uint32_t voxel_id, const uint8_t class_i) {
-    if (voxel_id < num_voxels_)
-        voxel_grid_[voxel_id] = class_i;
+void MultiClassVoxelGrid::SetAggregation(const VoxelAggregation aggregation) {
+    if (aggregation == aggregation_)
+        return;
+    aggregation_ = aggregation;
+    ResetAggregationStorage();
 }
 
-int MultiClassVoxelGrid::GetVoxelClass(const uint32_t voxel_id) const {
-    if (voxel_id < num_voxels_)
-        return voxel_grid_[voxel_id];
-    else
-        return -1;
-    return (voxel_id < num_voxels_) ? voxel_grid_[voxel_id] : -1;
+// only the votes of the current aggregation and storage are allocated
+void MultiClassVoxelGrid::ResetAggregationStorage() {
+    const bool atomic = SupportsConcurrentWrites();
+    const bool majority = (aggregation_ == VoxelAggregation::majority);
+    votes_.Reset((!atomic && majority) ? num_voxels_ : 0);
+    atomic_classes_.Reset((atomic && !majority) ? num_voxels_ : 0);
+    atomic_votes_.Reset((atomic && majority) ? num_voxels_ : 0);
+}
+
+bool MultiClassVoxelGrid::IsVoxelOccupied(const VoxelID voxel_id) const {
+    if (SupportsConcurrentWrites())
+        return GetVoxelClass(voxel_id) != 0;
+    return voxel_grid_.IsOccupied(voxel_id);
 }
 
-unsigned int MultiClassVoxelGrid::GetNumOccupiedVoxels() const {
-    unsigned int num_occupied_voxels = 0;
-    for (const auto& voxel: voxel_grid_) {
-        if (voxel != 0)
-            num_occupied_voxels++;
+void MultiClassVoxelGrid::SetVoxelClass(const VoxelID voxel_id, const uint8_t class_i) {
+    if (voxel_id >= num_voxels_)
+        return;
+    if (SupportsConcurrentWrites()) {
+        if (aggregation_ == VoxelAggregation::last) {
+            const uint8_t previous = atomic_classes_.Exchange(voxel_id, class_i);
+            atomic_classes_.CountOccupied(previous != 0, class_i != 0);
+        } else {
+            const uint64_t previous = atomic_votes_.Update(voxel_id, [&](const uint64_t votes) { return AddVote(votes, class_i); });
+            atomic_votes_.CountOccupied(GetMajorityVote(previous) != 0, GetMajorityVote(AddVote(previous, class_i)) != 0);
+        }
+        return;
+    }
+    if (aggregation_ == VoxelAggregation::last) {
+        voxel_grid_.Set(voxel_id, class_i);
+        return;
     }
-    return num_occupied_voxels;
+    // class 0 votes for an empty voxel
+    const uint64_t votes = AddVote(votes_.Get(voxel_id), class_i);
+    votes_.Set(voxel_id, votes);
+    voxel_grid_.Set(voxel_id, GetMajorityVote(votes));
+}
+
+int MultiClassVoxelGrid::GetVoxelClass(const VoxelID voxel_id) const {
+    if (voxel_id >= num_voxels_)
+        return -1;
+    if (!SupportsConcurrentWrites())
+        return voxel_grid_.Get(voxel_id);
+    if (aggregation_ == VoxelAggregation::last)
+        return atomic_classes_.Get(voxel_id);
+    return GetMajorityVote(atomic_votes_.Get(voxel_id));
 }
 
-const Eigen::Vector3i& MultiClassVoxelGrid::GetVoxelColor(const uint32_t voxel_id) const {
+uint64_t MultiClassVoxelGrid::GetNumOccupiedVoxels() const {
+    if (!SupportsConcurrentWrites())
+        return voxel_grid_.GetNumOccupied();
+    if (aggregation_ == VoxelAggregation::last)
+        return atomic_classes_.GetNumOccupied();
+    return atomic_votes_.GetNumOccupied();
+}
+
+Eigen::Vector3i MultiClassVoxelGrid::GetVoxelColor(const VoxelID voxel_id) const {
     const int class_i = GetVoxelClass(voxel_id);
     return class_color_mapping[class_i];
 }
 
+template <typename Function>
+void MultiClassVoxelGrid::ForEachOccupiedVoxel(const Function& function) const {
+    if (SupportsConcurrentWrites()) {
+        if (aggregation_ == VoxelAggregation::last) {
+            atomic_classes_.ForEachNonZero([&](const VoxelID voxel_id, const uint8_t) {
+                function(voxel_id, GetVoxel(voxel_id));
+            });
+            return;
+        }
+        atomic_votes_.ForEachNonZero([&](const VoxelID voxel_id, const uint64_t votes) {
+            if (GetMajorityVote(votes) != 0)
+                function(voxel_id, GetVoxel(voxel_id));
+        });
+        return;
+    }
+    if (!voxel_grid_.IsSparse()) {
+        voxel_grid_.ForEachOccupied([&](const VoxelID voxel_id, const uint8_t) {
+            function(voxel_id, GetVoxel(voxel_id));
+        });
+        return;
+    }
+    std::vector<VoxelID> voxel_ids;
+    voxel_ids.reserve(voxel_grid_.GetNumOccupied());
+    voxel_grid_.ForEachOccupied([&](const VoxelID voxel_id, const uint8_t) {
+        voxel_ids.push_back(voxel_id);
+    });
+    ForEachVoxelID(voxel_ids, function);
+}
+
+template class VoxelGrid<MultiClassVoxelGrid>;
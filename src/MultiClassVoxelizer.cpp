@@ -8,52 +8,241 @@
 
 #include "MultiClassVoxelizer.h"
 
+#include <algorithm>
+
+void MultiClassVoxelizer::SetPerFaceParity(const bool per_face_parity) {
+    per_face_parity_ = per_face_parity;
+}
+
 void MultiClassVoxelizer::Voxelize(MultiClassVoxelGrid& voxel_grid,
-                                   std::vector<Eigen::Vector3f>& vertices,
-                                   std::vector<uint32_t>& faces,
-                                   std::vector<uint16_t>& vertex_classes) {
+                                   const std::vector<Eigen::Vector3f>& vertices,
+                                   const std::vector<uint32_t>& faces,
+                                   const std::vector<uint16_t>& vertex_classes) {
+    Voxelize(std::vector<MultiClassVoxelGrid*>(1, &voxel_grid), vertices, faces, vertex_classes);
+}
+
+void MultiClassVoxelizer::Voxelize(const std::vector<MultiClassVoxelGrid*>& voxel_grids,
+                                   const std::vector<Eigen::Vector3f>& vertices,
+                                   const std::vector<uint32_t>& faces,
+                                   const std::vector<uint16_t>& vertex_classes) {
+    stats_ = VoxelizeStats();
+    if (method_ == VoxelizationMethod::raster) {
+        for (const auto& voxel_grid: voxel_grids)
+            VoxelizeRaster(*voxel_grid, vertices, faces, vertex_classes);
+        return;
+    }
+    if (CanStampConcurrently(voxel_grids)) {
+        VoxelizeConcurrent(voxel_grids, vertices, faces, vertex_classes);
+        return;
+    }
+    if (num_threads_ > 1) {
+        VoxelizeParallel(voxel_grids, vertices, faces, vertex_classes);
+        return;
+    }
     
-    std::vector<uint32_t> split_faces;
-    int ten_percent_step = faces.size() / 10;
+    const auto start = std::chrono::steady_clock::now();
+    ScratchArray<Eigen::Vector3f> scratch_vertices(vertices);
+    ScratchArray<uint16_t> scratch_classes(vertex_classes);
+    std::vector<SplitTask> stack;
+    size_t num_vertices = vertices.size();
+    int ten_percent_step = std::max<int>(faces.size() / 10, 1);
+    // majority votes don't depend on face order, so neither may the classes
+    // of midpoints: their parity is counted per face instead of globally
+    const bool count_per_face = per_face_parity_ || (voxel_grids[0]->GetAggregation() == VoxelAggregation::majority);
     
     for (int i = 0; i < faces.size(); i+=3) {
+        if (count_per_face)
+            num_vertices = 0;
+        const Face face = {{ faces[i], faces[i+1], faces[i+2] }};
         
-        std::vector<uint32_t> face(3);
-        face[0] = faces[i];
-        face[1] = faces[i+1];
-        face[2] = faces[i+2];
-        
-		std::vector<uint32_t> sub_faces;
-		SplitFace(voxel_grid, vertices, vertex_classes, face, sub_faces);
-		split_faces.insert(split_faces.end(), sub_faces.begin(), sub_faces.end());
+        SplitAndStampFace(voxel_grids, scratch_vertices, scratch_classes, face, stack, num_vertices, stats_);
 
-        if ((i % ten_percent_step == 0 || (i-1) % ten_percent_step == 0 || (i-2) % ten_percent_step == 0) && i != 0)
+        if (verbose_ && (i % ten_percent_step == 0 || (i-1) % ten_percent_step == 0 || (i-2) % ten_percent_step == 0) && i != 0)
             std::cout << i / ten_percent_step << "0% " << std::flush;
     }
-    
-    for (auto split_face_vertex_i: split_faces) {
-        int voxel_id = voxel_grid.GetEnclosingVoxelID(vertices[split_face_vertex_i]);
-        voxel_grid.SetVoxelClass(voxel_id, vertex_classes[split_face_vertex_i]);
-    }
 
-    std::cout << "100%" << std::endl;
+    if (verbose_)
+        std::cout << "100%" << std::endl;
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    stats_.split_seconds = elapsed.count() - stats_.stamp_seconds;
 }
 
-void MultiClassVoxelizer::SplitFace(MultiClassVoxelGrid& voxel_grid,
-                                    std::vector<Eigen::Vector3f>& vertices,
-                                    std::vector<uint16_t>& vertex_classes,
-                                    std::vector<uint32_t>& face,
-                                    std::vector<uint32_t>& sub_faces) {
-    std::vector<uint32_t> first_sub_face(3);
-    std::vector<uint32_t> second_sub_face(3);
+void MultiClassVoxelizer::SplitAndStampFace(const std::vector<MultiClassVoxelGrid*>& voxel_grids,
+                                            ScratchArray<Eigen::Vector3f>& vertices,
+                                            ScratchArray<uint16_t>& vertex_classes,
+                                            const Face& face,
+                                            std::vector<SplitTask>& stack,
+                                            size_t& num_vertices,
+                                            VoxelizeStats& stats) {
+    SubdivideFace(*voxel_grids[0], vertices, face, stack,
+                  [&](const Face& split_face, const int longest_i) {
+                      stats.num_midpoints++;
+                      num_vertices++;
+                      vertex_classes.push_back((num_vertices % 2 == 0) ? vertex_classes[split_face[longest_i % 3]] :
+                                                                         vertex_classes[split_face[(longest_i + 1) % 3]]);
+                  },
+                  [&](const Face& leaf_face) {
+                      StampLeaf(stats, [&]() {
+                          const Eigen::Vector3f corners[3] = { vertices[leaf_face[0]], vertices[leaf_face[1]], vertices[leaf_face[2]] };
+                          VoxelID voxel_ids[3];
+                          for (const auto& voxel_grid: voxel_grids) {
+                              voxel_grid->GetEnclosingVoxelIDs(corners, 3, voxel_ids);
+                              for (int i = 0; i < 3; i++)
+                                  voxel_grid->SetVoxelClass(voxel_ids[i], vertex_classes[leaf_face[i]]);
+                          }
+                      });
+                  },
+                  [&]() {
+                      vertices.pop_back();
+                      vertex_classes.pop_back();
+                  });
+}
 
-    const int longest_i = SplitBaseFace(voxel_grid, vertices, face, sub_faces, 
-                                        first_sub_face, second_sub_face);
-    if (longest_i == -1)
-        return;
-    vertex_classes.push_back((vertices.size() % 2 == 0 ) ? vertex_classes[face[longest_i % 3]] : vertex_classes[face[(longest_i + 1) % 3]] );
+void MultiClassVoxelizer::SplitFace(const MultiClassVoxelGrid& voxel_grid,
+                                    ScratchArray<Eigen::Vector3f>& vertices,
+                                    std::vector<uint32_t>& midpoint_parents,
+                                    const Face& face,
+                                    std::vector<SplitTask>& stack,
+                                    std::vector<uint32_t>& sub_faces) const {
+    SubdivideFace(voxel_grid, vertices, face, stack,
+                  [&](const Face& split_face, const int longest_i) {
+                      midpoint_parents.push_back(split_face[longest_i % 3]);
+                      midpoint_parents.push_back(split_face[(longest_i + 1) % 3]);
+                  },
+                  [&](const Face& leaf_face) {
+                      sub_faces.insert(sub_faces.end(), leaf_face.begin(), leaf_face.end());
+                  },
+                  []() {});
+}
+
+void MultiClassVoxelizer::VoxelizeParallel(const std::vector<MultiClassVoxelGrid*>& voxel_grids,
+                                           const std::vector<Eigen::Vector3f>& vertices,
+                                           const std::vector<uint32_t>& faces,
+                                           const std::vector<uint16_t>& vertex_classes) {
+    const MultiClassVoxelGrid& finest_grid = *voxel_grids[0];
+    const size_t num_grids = voxel_grids.size();
+    const bool count_per_face = per_face_parity_ || (finest_grid.GetAggregation() == VoxelAggregation::majority);
+    const size_t num_shared = vertices.size();
+    const size_t num_chunks = GetNumFaceChunks(faces.size() / 3);
+    std::vector<std::vector<uint32_t>> chunk_parents(num_chunks);
+    std::vector<std::vector<uint32_t>> chunk_sub_faces(num_chunks);
+    std::vector<std::vector<VoxelID>> chunk_voxel_ids(num_chunks);
+    
+    stats_.split_seconds = ForEachFaceChunk(faces.size() / 3, [&](const size_t chunk_i, const size_t first_face, const size_t last_face) {
+        ScratchArray<Eigen::Vector3f> scratch_vertices(vertices);
+        std::vector<uint32_t>& sub_faces = chunk_sub_faces[chunk_i];
+        std::vector<uint32_t>& parents = chunk_parents[chunk_i];
+        std::vector<SplitTask> stack;
+        for (size_t i = 3 * first_face; i < 3 * last_face; i+=3) {
+            const Face face = {{ faces[i], faces[i+1], faces[i+2] }};
+            const size_t first_parent = parents.size();
+            SplitFace(finest_grid, scratch_vertices, parents, face, stack, sub_faces);
+            // per-face parity, see Voxelize. Both parent slots get the chosen
+            // parent, so the parity of the merged index no longer matters
+            if (count_per_face) {
+                for (size_t j = first_parent; j < parents.size(); j+=2) {
+                    const bool even = ((j - first_parent) / 2 + 1) % 2 == 0;
+                    parents[j] = parents[j+1] = even ? parents[j] : parents[j+1];
+                }
+            }
+        }
+        // voxel ids of all grids per sub-face vertex
+        AppendSubFaceVoxelIDs(voxel_grids, scratch_vertices, sub_faces, chunk_voxel_ids[chunk_i]);
+    });
     
-    SplitFace(voxel_grid, vertices, vertex_classes, first_sub_face, sub_faces);
-    SplitFace(voxel_grid, vertices, vertex_classes, second_sub_face, sub_faces);
+    // merge in face order so midpoint indices, midpoint classes and the
+    // last-write-wins stamping match the serial path exactly. Midpoints are
+    // numbered after the input vertices, but their classes are kept here
+    std::vector<uint16_t> midpoint_classes;
+    auto get_class = [&](const uint32_t i) -> uint16_t {
+        return (i < num_shared) ? vertex_classes[i] : midpoint_classes[i - num_shared];
+    };
+    const auto merge_start = std::chrono::steady_clock::now();
+    for (size_t chunk_i = 0; chunk_i < num_chunks; chunk_i++) {
+        const std::vector<uint32_t>& parents = chunk_parents[chunk_i];
+        stats_.num_midpoints += parents.size() / 2;
+        stats_.num_sub_faces += chunk_sub_faces[chunk_i].size() / 3;
+        const uint32_t offset = midpoint_classes.size();
+        auto global_index = [&](const uint32_t i) { return (i < num_shared) ? i : i + offset; };
+        for (size_t j = 0; j < parents.size(); j+=2) {
+            const size_t num_vertices = num_shared + midpoint_classes.size() + 1;
+            const uint16_t class_i = (num_vertices % 2 == 0) ? get_class(global_index(parents[j])) :
+                                                               get_class(global_index(parents[j+1]));
+            midpoint_classes.push_back(class_i);
+        }
+        const std::vector<uint32_t>& sub_faces = chunk_sub_faces[chunk_i];
+        const std::vector<VoxelID>& voxel_ids = chunk_voxel_ids[chunk_i];
+        for (size_t j = 0; j < sub_faces.size(); j++) {
+            for (size_t grid_i = 0; grid_i < num_grids; grid_i++)
+                voxel_grids[grid_i]->SetVoxelClass(voxel_ids[num_grids * j + grid_i], get_class(global_index(sub_faces[j])));
+        }
+        std::vector<uint32_t>().swap(chunk_parents[chunk_i]);
+        std::vector<uint32_t>().swap(chunk_sub_faces[chunk_i]);
+        std::vector<VoxelID>().swap(chunk_voxel_ids[chunk_i]);
+    }
+    const std::chrono::duration<double> merge_elapsed = std::chrono::steady_clock::now() - merge_start;
+    stats_.stamp_seconds = merge_elapsed.count();
+    if (verbose_)
+        std::cout << "100%" << std::endl;
 }
+
+void MultiClassVoxelizer::VoxelizeConcurrent(const std::vector<MultiClassVoxelGrid*>& voxel_grids,
+                                             const std::vector<Eigen::Vector3f>& vertices,
+                                             const std::vector<uint32_t>& faces,
+                                             const std::vector<uint16_t>& vertex_classes) {
+    std::vector<VoxelizeStats> chunk_stats(GetNumFaceChunks(faces.size() / 3));
+    const double seconds = ForEachFaceChunk(faces.size() / 3, [&](const size_t chunk_i, const size_t first_face, const size_t last_face) {
+        ScratchArray<Eigen::Vector3f> scratch_vertices(vertices);
+        ScratchArray<uint16_t> scratch_classes(vertex_classes);
+        std::vector<SplitTask> stack;
+        for (size_t i = 3 * first_face; i < 3 * last_face; i+=3) {
+            // majority aggregation, so midpoint parity is counted per face
+            size_t num_vertices = 0;
+            const Face face = {{ faces[i], faces[i+1], faces[i+2] }};
+            SplitAndStampFace(voxel_grids, scratch_vertices, scratch_classes, face, stack, num_vertices, chunk_stats[chunk_i]);
+        }
+    });
+    for (const auto& stats: chunk_stats)
+        stats_ += stats;
+    stats_.split_seconds = seconds - stats_.stamp_seconds;
+    if (verbose_)
+        std::cout << "100%" << std::endl;
+}
+
+void MultiClassVoxelizer::VoxelizeRaster(MultiClassVoxelGrid& voxel_grid,
+                                         const std::vector<Eigen::Vector3f>& vertices,
+                                         const std::vector<uint32_t>& faces,
+                                         const std::vector<uint16_t>& vertex_classes) {
+    const size_t num_chunks = GetNumFaceChunks(faces.size() / 3);
+    std::vector<std::vector<VoxelID>> chunk_voxel_ids(num_chunks);
+    std::vector<std::vector<uint8_t>> chunk_classes(num_chunks);
+    const bool concurrent = CanStampConcurrently(std::vector<MultiClassVoxelGrid*>(1, &voxel_grid));
     
+    stats_.split_seconds += ForEachFaceChunk(faces.size() / 3, [&](const size_t chunk_i, const size_t first_face, const size_t last_face) {
+        std::vector<VoxelSample> samples;
+        for (size_t i = 3 * first_face; i < 3 * last_face; i+=3) {
+            RasterizeFace(voxel_grid, vertices[faces[i]], vertices[faces[i+1]], vertices[faces[i+2]], samples);
+            for (const auto& sample: samples) {
+                // class of the face vertex closest to the voxel center
+                int nearest_i;
+                sample.barycentric.maxCoeff(&nearest_i);
+                if (concurrent) {
+                    voxel_grid.SetVoxelClass(sample.voxel_id, vertex_classes[faces[i + nearest_i]]);
+                    continue;
+                }
+                chunk_voxel_ids[chunk_i].push_back(sample.voxel_id);
+                chunk_classes[chunk_i].push_back(vertex_classes[faces[i + nearest_i]]);
+            }
+        }
+    });
+    
+    const auto merge_start = std::chrono::steady_clock::now();
+    for (size_t chunk_i = 0; chunk_i < num_chunks; chunk_i++) {
+        for (size_t j = 0; j < chunk_voxel_ids[chunk_i].size(); j++)
+            voxel_grid.SetVoxelClass(chunk_voxel_ids[chunk_i][j], chunk_classes[chunk_i][j]);
+    }
+    const std::chrono::duration<double> merge_elapsed = std::chrono::steady_clock::now() - merge_start;
+    stats_.stamp_seconds += merge_elapsed.count();
+    if (verbose_)
+        std::cout << "100%" << std::endl;
+}
@@ -0,0 +1,139 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#include "StageReport.h"
+
+#include <sys/resource.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+void StageReport::Start(const std::string& stage) {
+    Stop();
+    Stage& started = GetStage(stage);
+    running_ = &started - stages_.data();
+    wall_start_ = std::chrono::steady_clock::now();
+    cpu_start_ = GetCPUSeconds();
+}
+
+void StageReport::Stop() {
+    if (running_ < 0)
+        return;
+    Stage& stage = stages_[running_];
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - wall_start_;
+    stage.wall_seconds += elapsed.count();
+    stage.cpu_seconds += GetCPUSeconds() - cpu_start_;
+    stage.peak_rss_bytes = GetPeakMemoryUsage();
+    running_ = -1;
+}
+
+void StageReport::AddCount(const std::string& stage, const std::string& name, const double value) {
+    std::vector<std::pair<std::string, double>>& counts = GetStage(stage).counts;
+    for (auto& count: counts) {
+        if (count.first == name) {
+            count.second += value;
+            return;
+        }
+    }
+    counts.emplace_back(name, value);
+}
+
+void StageReport::Clear() {
+    stages_.clear();
+    running_ = -1;
+}
+
+double StageReport::GetWallSeconds(const std::string& stage) const {
+    for (const auto& existing: stages_) {
+        if (existing.name == stage)
+            return existing.wall_seconds;
+    }
+    return 0;
+}
+
+void StageReport::WriteJSON(std::ostream& out, const int indent) const {
+    const std::string pad(indent, ' ');
+    out << "{";
+    for (size_t i = 0; i < stages_.size(); i++) {
+        const Stage& stage = stages_[i];
+        out << ((i == 0) ? "\n" : ",\n") << pad << "  " << Quote(stage.name) << ": {"
+            << "\"wall_seconds\": ";
+        WriteNumber(out, stage.wall_seconds);
+        out << ", \"cpu_seconds\": ";
+        WriteNumber(out, stage.cpu_seconds);
+        out << ", \"peak_rss_bytes\": " << stage.peak_rss_bytes;
+        for (const auto& count: stage.counts) {
+            out << ", " << Quote(count.first) << ": ";
+            WriteNumber(out, count.second);
+        }
+        out << "}";
+    }
+    out << (stages_.empty() ? "}" : "\n" + pad + "}");
+}
+
+size_t StageReport::GetPeakMemoryUsage() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+double StageReport::GetCPUSeconds() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+std::string StageReport::Quote(const std::string& text) {
+    std::string quoted("\"");
+    for (const char c: text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+void StageReport::WriteNumber(std::ostream& out, const double value) {
+    if (!std::isfinite(value)) {
+        out << "null";
+        return;
+    }
+    if (value == std::floor(value) && std::fabs(value) < 9007199254740992.0) {
+        out << static_cast<int64_t>(value);
+        return;
+    }
+    char number[32];
+    snprintf(number, sizeof(number), "%.6g", value);
+    out << number;
+}
+
+StageReport::Stage& StageReport::GetStage(const std::string& name) {
+    for (auto& stage: stages_) {
+        if (stage.name == name)
+            return stage;
+    }
+    stages_.emplace_back();
+    stages_.back().name = name;
+    return stages_.back();
+}
@@ -0,0 +1,199 @@
+/*
+ Classy Voxelizer
+ 
+ BSD 2-Clause License
+ Copyright (c) 2018, Dario Rethage
+ See LICENSE at package root for full license
+ */
+
+#include "VoxelFile.h"
+
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "MappedFile.h"
+
+static const char kMagic[4] = {'C', 'V', 'O', 'X'};
+static const uint16_t kVersion = 1;
+// magic, version, number of class colors, voxel size, grid min, voxels per
+// dimension, number of voxels
+static const size_t kFixedHeaderSize = 4 + 2 + 2 + 4 + 3 * 4 + 3 * 4 + 8;
+
+template <typename T>
+static T ReadLittleEndian(const char* data) {
+    char bytes[sizeof(T)];
+    memcpy(bytes, data, sizeof(T));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (size_t i = 0; i < sizeof(T) / 2; i++)
+        std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+#endif
+    T value;
+    memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+// bytes written to out, at most 10
+static size_t EncodeVarint(uint64_t value, uint8_t* out) {
+    size_t size = 0;
+    while (value >= 0x80) {
+        out[size++] = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    out[size++] = static_cast<uint8_t>(value);
+    return size;
+}
+
+// false if the varint is cut off by end or longer than 64 bits
+static bool DecodeVarint(const uint8_t*& data, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && data != end; shift += 7) {
+        const uint8_t byte = *data++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+void VoxelFileHeader::Write(BufferedFileWriter& file_out) const {
+    file_out.Write(kMagic, sizeof(kMagic));
+    file_out.WriteLittleEndian(kVersion);
+    file_out.WriteLittleEndian(static_cast<uint16_t>(class_colors.size()));
+    file_out.WriteLittleEndian(voxel_size);
+    for (int i = 0; i < 3; i++)
+        file_out.WriteLittleEndian(grid_min[i]);
+    for (int i = 0; i < 3; i++)
+        file_out.WriteLittleEndian(static_cast<int32_t>(voxels_per_dim[i]));
+    file_out.WriteLittleEndian(num_voxels);
+    for (const auto& color: class_colors) {
+        for (int i = 0; i < 3; i++)
+            file_out.WriteLittleEndian(static_cast<uint8_t>(color[i]));
+    }
+}
+
+size_t VoxelFileHeader::Read(const char* data, const size_t size) {
+    if (size < kFixedHeaderSize || memcmp(data, kMagic, sizeof(kMagic)) != 0 ||
+        ReadLittleEndian<uint16_t>(data + 4) != kVersion)
+        return 0;
+    const size_t num_classes = ReadLittleEndian<uint16_t>(data + 6);
+    if (size < kFixedHeaderSize + 3 * num_classes)
+        return 0;
+    voxel_size = ReadLittleEndian<float>(data + 8);
+    for (int i = 0; i < 3; i++) {
+        grid_min[i] = ReadLittleEndian<float>(data + 12 + 4 * i);
+        voxels_per_dim[i] = ReadLittleEndian<int32_t>(data + 24 + 4 * i);
+        if (voxels_per_dim[i] < 0)
+            return 0;
+    }
+    num_voxels = ReadLittleEndian<uint64_t>(data + 36);
+    const uint8_t* colors = reinterpret_cast<const uint8_t*>(data + kFixedHeaderSize);
+    class_colors.resize(num_classes);
+    for (size_t i = 0; i < num_classes; i++)
+        class_colors[i] << colors[3*i], colors[3*i+1], colors[3*i+2];
+    return kFixedHeaderSize + 3 * num_classes;
+}
+
+VoxelRunWriter::VoxelRunWriter(BufferedFileWriter& file_out, const bool with_classes):
+    file_out_(file_out), with_classes_(with_classes) {
+    
+}
+
+void VoxelRunWriter::Flush() {
+    if (run_end_ == run_start_)
+        return;
+    // two's complement difference, so runs may also go back in id
+    const int64_t offset = static_cast<int64_t>(run_start_ - previous_end_);
+    const uint64_t zigzag_offset = (static_cast<uint64_t>(offset) << 1) ^ static_cast<uint64_t>(offset >> 63);
+    uint8_t run[20];
+    size_t run_size = EncodeVarint(zigzag_offset, run);
+    run_size += EncodeVarint(run_end_ - run_start_, run + run_size);
+    file_out_.Write(run, run_size);
+    if (with_classes_)
+        file_out_.WriteLittleEndian(static_cast<uint8_t>(run_class_));
+    else
+        file_out_.Write(run_colors_.data(), run_colors_.size());
+    run_colors_.clear();
+    previous_end_ = run_end_;
+    run_start_ = run_end_;
+}
+
+bool ReadVoxelFile(const std::string& filepath, VoxelArrays& voxels) {
+    // decoded straight out of the mapping into arrays sized from the header
+    MappedFile mapped_file(filepath);
+    VoxelFileHeader header;
+    const size_t header_size = mapped_file.IsOpen() ? header.Read(mapped_file.GetData(), mapped_file.GetSize()) : 0;
+    if (header_size == 0) {
+        std::cerr << "Error: " << filepath << " is not a voxel file" << std::endl;
+        return false;
+    }
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(mapped_file.GetData()) + header_size;
+    const uint8_t* data_end = reinterpret_cast<const uint8_t*>(mapped_file.GetData()) + mapped_file.GetSize();
+    const uint64_t num_voxels = header.num_voxels;
+    const Eigen::Vector3i& voxels_per_dim = header.voxels_per_dim;
+    const VoxelID grid_size = static_cast<VoxelID>(voxels_per_dim[0]) * voxels_per_dim[1] * voxels_per_dim[2];
+    const bool with_classes = !header.class_colors.empty();
+    if (num_voxels > grid_size) {
+        std::cerr << "Error: " << filepath << " is malformed" << std::endl;
+        return false;
+    }
+    
+    voxels.voxel_size = header.voxel_size;
+    voxels.grid_min = header.grid_min;
+    voxels.coordinates.resize(3 * num_voxels);
+    voxels.centers.resize(3 * num_voxels);
+    voxels.colors.resize(3 * num_voxels);
+    voxels.classes.resize(num_voxels);
+    const float voxel_size = header.voxel_size;
+    uint64_t voxel_i = 0;
+    VoxelID previous_end = 0;
+    while (voxel_i < num_voxels) {
+        uint64_t zigzag_offset, run_length;
+        if (!DecodeVarint(data, data_end, zigzag_offset) || !DecodeVarint(data, data_end, run_length))
+            break;
+        const int64_t offset = static_cast<int64_t>(zigzag_offset >> 1) ^ -static_cast<int64_t>(zigzag_offset & 1);
+        const VoxelID run_start = previous_end + offset;
+        if (run_length == 0 || run_length > num_voxels - voxel_i ||
+            run_start >= grid_size || run_length > grid_size - run_start)
+            break;
+        const uint8_t* colors = data;
+        int class_i = 0;
+        if (with_classes) {
+            if (data == data_end || *data >= header.class_colors.size())
+                break;
+            class_i = *data++;
+            colors = nullptr;
+        } else {
+            if (static_cast<uint64_t>(data_end - data) < 3 * run_length)
+                break;
+            data += 3 * run_length;
+        }
+        // ids in a run step along x, with carries into y and z
+        Eigen::Vector3i voxel(run_start % voxels_per_dim[0],
+                              (run_start / voxels_per_dim[0]) % voxels_per_dim[1],
+                              run_start / (static_cast<VoxelID>(voxels_per_dim[0]) * voxels_per_dim[1]));
+        for (uint64_t j = 0; j < run_length; j++, voxel_i++) {
+            const Eigen::Vector3i color = with_classes ? header.class_colors[class_i] :
+                                          Eigen::Vector3i(colors[3*j], colors[3*j+1], colors[3*j+2]);
+            for (int i = 0; i < 3; i++) {
+                voxels.coordinates[3*voxel_i+i] = voxel[i];
+                voxels.centers[3*voxel_i+i] = (voxel[i] * voxel_size) + header.grid_min[i] + voxel_size / 2;
+                voxels.colors[3*voxel_i+i] = color[i];
+            }
+            voxels.classes[voxel_i] = class_i;
+            if (++voxel[0] == voxels_per_dim[0]) {
+                voxel[0] = 0;
+                if (++voxel[1] == voxels_per_dim[1]) {
+                    voxel[1] = 0;
+                    voxel[2]++;
+                }
+            }
+        }
+        previous_end = run_start + run_length;
+    }
+    if (voxel_i != num_voxels || data != data_end) {
+        std::cerr << "Error: " << filepath << " is malformed" << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -7,103 +7,316 @@
  */
 
 #include "VoxelGrid.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
+#include <iostream>
+#include <tuple>
+#include <unordered_map>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// bounds of a grid as the batched voxel id kernels take them
+struct VoxelLattice {
+    float grid_min[3];
+    float grid_max[3];
+    float inverse_voxel_size;
+    int32_t voxels_per_dim[3];
+};
+
+#if defined(__SSE2__)
+// x, y and z of 4 packed points, i.e. 12 consecutive floats, each in one register
+static inline void LoadPoints(const float* points, __m128& x, __m128& y, __m128& z) {
+    const __m128 a = _mm_loadu_ps(points);      // x0 y0 z0 x1
+    const __m128 b = _mm_loadu_ps(points + 4);  // y1 z1 x2 y2
+    const __m128 c = _mm_loadu_ps(points + 8);  // z2 x3 y3 z3
+    x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 0, 3, 2)), _MM_SHUFFLE(3, 0, 3, 0));
+    y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+                       _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+                       _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+// one axis: the voxel index, and whether the coordinate is inside the grid
+static inline __m128i GetVoxelIndices(const __m128 coordinate, const VoxelLattice& lattice, const int axis, __m128& inside) {
+    const __m128 grid_min = _mm_set1_ps(lattice.grid_min[axis]);
+    inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(coordinate, grid_min),
+                                           _mm_cmple_ps(coordinate, _mm_set1_ps(lattice.grid_max[axis]))));
+    const __m128i voxel = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(coordinate, grid_min),
+                                                      _mm_set1_ps(lattice.inverse_voxel_size)));
+    inside = _mm_and_ps(inside, _mm_castsi128_ps(_mm_cmplt_epi32(voxel, _mm_set1_epi32(lattice.voxels_per_dim[axis]))));
+    return voxel;
+}
+
+// ids of 2 voxels, in 64 bit lanes, from their indices along each axis in the
+// low halves of the lanes. Lanes in outside are set to all ones, i.e.
+// kVoxelOutOfGrid
+static inline __m128i ComposeVoxelIDs(const __m128i x, const __m128i y, const __m128i z, const __m128i outside,
+                                      const VoxelLattice& lattice) {
+    const __m128i y_size = _mm_set1_epi32(lattice.voxels_per_dim[1]);
+    const __m128i x_size = _mm_set1_epi32(lattice.voxels_per_dim[0]);
+    // (z * y_size + y) * x_size + x, the last product 64 by 32 bits
+    const __m128i row = _mm_add_epi64(_mm_mul_epu32(z, y_size), y);
+    const __m128i row_start = _mm_add_epi64(_mm_mul_epu32(row, x_size),
+                                            _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(row, 32), x_size), 32));
+    return _mm_or_si128(_mm_add_epi64(row_start, x), outside);
+}
+
+// 4 points, num_points of which are written out
+static void GetVoxelIDsSSE2(const float* points, const size_t num_points, const VoxelLattice& lattice, VoxelID* voxel_ids) {
+    __m128 x, y, z;
+    LoadPoints(points, x, y, z);
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    const __m128i voxel_x = GetVoxelIndices(x, lattice, 0, inside);
+    const __m128i voxel_y = GetVoxelIndices(y, lattice, 1, inside);
+    const __m128i voxel_z = GetVoxelIndices(z, lattice, 2, inside);
+    const __m128i outside = _mm_xor_si128(_mm_castps_si128(inside), _mm_set1_epi32(-1));
+    const __m128i zero = _mm_setzero_si128();
+    // inside the grid indices are non-negative, so zero extending them is exact
+    __m128i ids[2] = {
+        ComposeVoxelIDs(_mm_unpacklo_epi32(voxel_x, zero), _mm_unpacklo_epi32(voxel_y, zero),
+                        _mm_unpacklo_epi32(voxel_z, zero), _mm_unpacklo_epi32(outside, outside), lattice),
+        ComposeVoxelIDs(_mm_unpackhi_epi32(voxel_x, zero), _mm_unpackhi_epi32(voxel_y, zero),
+                        _mm_unpackhi_epi32(voxel_z, zero), _mm_unpackhi_epi32(outside, outside), lattice)
+    };
+    if (num_points == 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(voxel_ids), ids[0]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(voxel_ids + 2), ids[1]);
+        return;
+    }
+    std::copy(reinterpret_cast<const VoxelID*>(ids), reinterpret_cast<const VoxelID*>(ids) + num_points, voxel_ids);
+}
+#endif
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define CLASSY_VOXELIZER_AVX2
+// compiled for AVX2 whatever the target of the build, only called if the CPU
+// has it. The AVX2 versions of ComposeVoxelIDs and GetVoxelIDsSSE2
+__attribute__((target("avx2")))
+static inline __m256i ComposeVoxelIDsAVX2(const __m128i x, const __m128i y, const __m128i z, const __m128i outside,
+                                          const VoxelLattice& lattice) {
+    const __m256i y_size = _mm256_set1_epi32(lattice.voxels_per_dim[1]);
+    const __m256i x_size = _mm256_set1_epi32(lattice.voxels_per_dim[0]);
+    const __m256i row = _mm256_add_epi64(_mm256_mul_epu32(_mm256_cvtepu32_epi64(z), y_size), _mm256_cvtepu32_epi64(y));
+    const __m256i row_start = _mm256_add_epi64(_mm256_mul_epu32(row, x_size),
+                                               _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(row, 32), x_size), 32));
+    return _mm256_or_si256(_mm256_add_epi64(row_start, _mm256_cvtepu32_epi64(x)), _mm256_cvtepi32_epi64(outside));
+}
+
+__attribute__((target("avx2")))
+static void GetVoxelIDsAVX2(const float* points, const size_t num_points, const VoxelLattice& lattice, VoxelID* voxel_ids) {
+    __m128 x_low, y_low, z_low, x_high, y_high, z_high;
+    LoadPoints(points, x_low, y_low, z_low);
+    LoadPoints(points + 12, x_high, y_high, z_high);
+    const __m256 coordinates[3] = {
+        _mm256_insertf128_ps(_mm256_castps128_ps256(x_low), x_high, 1),
+        _mm256_insertf128_ps(_mm256_castps128_ps256(y_low), y_high, 1),
+        _mm256_insertf128_ps(_mm256_castps128_ps256(z_low), z_high, 1)
+    };
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    __m256i voxels[3];
+    for (int axis = 0; axis < 3; axis++) {
+        const __m256 grid_min = _mm256_set1_ps(lattice.grid_min[axis]);
+        inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(coordinates[axis], grid_min, _CMP_GE_OQ),
+                                                     _mm256_cmp_ps(coordinates[axis], _mm256_set1_ps(lattice.grid_max[axis]), _CMP_LE_OQ)));
+        voxels[axis] = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(coordinates[axis], grid_min),
+                                                         _mm256_set1_ps(lattice.inverse_voxel_size)));
+        inside = _mm256_and_ps(inside, _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(lattice.voxels_per_dim[axis]), voxels[axis])));
+    }
+    const __m256i outside = _mm256_xor_si256(_mm256_castps_si256(inside), _mm256_set1_epi32(-1));
+    __m256i ids[2];
+    for (int half = 0; half < 2; half++) {
+        ids[half] = ComposeVoxelIDsAVX2(half ? _mm256_extracti128_si256(voxels[0], 1) : _mm256_castsi256_si128(voxels[0]),
+                                        half ? _mm256_extracti128_si256(voxels[1], 1) : _mm256_castsi256_si128(voxels[1]),
+                                        half ? _mm256_extracti128_si256(voxels[2], 1) : _mm256_castsi256_si128(voxels[2]),
+                                        half ? _mm256_extracti128_si256(outside, 1) : _mm256_castsi256_si128(outside),
+                                        lattice);
+    }
+    if (num_points == 8) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(voxel_ids), ids[0]);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(voxel_ids + 4), ids[1]);
+        return;
+    }
+    std::copy(reinterpret_cast<const VoxelID*>(ids), reinterpret_cast<const VoxelID*>(ids) + num_points, voxel_ids);
+}
+#endif
 
 VoxelGridInterface::VoxelGridInterface(const Eigen::Vector3f& grid_min,
                                        const Eigen::Vector3f& grid_max,
-                                       float voxel_size):
-    grid_min_(grid_min), grid_max_(grid_max), voxel_size_(voxel_size) {
+                                       float voxel_size,
+                                       const VoxelStorage storage): storage_(storage) {
+    SetBounds(grid_min, grid_max, voxel_size);
+}
+
+void VoxelGridInterface::SetBounds(const Eigen::Vector3f& grid_min,
+                                   const Eigen::Vector3f& grid_max,
+                                   const float voxel_size) {
+    grid_min_ = grid_min;
+    grid_max_ = grid_max;
+    voxel_size_ = voxel_size;
+    inverse_voxel_size_ = 1.0f / voxel_size;
     const Eigen::Vector3f grid_size = grid_max - grid_min;
-    voxels_per_dim_ = (grid_size / voxel_size).cast<int>();
-    num_voxels_ = voxels_per_dim_.prod();
+    // -Ofast may turn the division into a multiplication by the reciprocal in
+    // some copies of this code and not in others, which truncates differently
+    // when a bound is a whole number of voxels. Spelling it out keeps grids
+    // reset to the same bounds the same size
+    voxels_per_dim_ = (grid_size * inverse_voxel_size_).cast<int>();
+    num_voxels_ = static_cast<VoxelID>(voxels_per_dim_[0]) * voxels_per_dim_[1] * voxels_per_dim_[2];
 }
 
-bool VoxelGridInterface::IsVoxelOccupied(const Eigen::Vector3f& vertex) const {
-    const uint32_t voxel_id = GetEnclosingVoxelID(vertex);
-    if (voxel_id == -1)
-        return false;
-    return IsVoxelOccupied(voxel_id);
-}
-
-unsigned int VoxelGridInterface::GetNumOccupied() const {
-    unsigned int numOccupied = 0;
-    for (int i = 0; i < voxels_per_dim_[0]; i++) {
-        for (int j = 0; j < voxels_per_dim_[1]; j++) {
-            for (int k = 0; k < voxels_per_dim_[2]; k++) {
-                const uint32_t voxel_id = static_cast<unsigned int>(voxels_per_dim_[0] *
-                                                                    voxels_per_dim_[1] * k +
-                                                                    voxels_per_dim_[0] * j + i);
-                if (IsVoxelOccupied(voxel_id))
-                    numOccupied++;
-            }
+VoxelAggregation VoxelGridInterface::GetAggregation() const {
+    return aggregation_;
+}
+
+bool VoxelGridInterface::SupportsConcurrentWrites() const {
+    return storage_ == VoxelStorage::atomic;
+}
+
+#if defined(__SSE2__)
+// kernel on every block of block_size points, the last, partial block padded
+// with copies of the last point
+template <size_t block_size, typename Kernel>
+static void ForEachPointBlock(const float* points, const size_t num_points, const VoxelLattice& lattice,
+                              VoxelID* voxel_ids, const Kernel& kernel) {
+    size_t i = 0;
+    for (; i + block_size <= num_points; i += block_size)
+        kernel(points + 3 * i, block_size, lattice, voxel_ids + i);
+    if (i == num_points)
+        return;
+    float padded[3 * block_size];
+    for (size_t j = 0; j < block_size; j++) {
+        const float* point = points + 3 * std::min(i + j, num_points - 1);
+        std::copy(point, point + 3, padded + 3 * j);
+    }
+    kernel(padded, num_points - i, lattice, voxel_ids + i);
+}
+#endif
+
+SimdLevel VoxelGridInterface::GetSupportedSimdLevel() {
+#if defined(CLASSY_VOXELIZER_AVX2)
+    static const SimdLevel simd_level = __builtin_cpu_supports("avx2") ? SimdLevel::avx2 : SimdLevel::sse2;
+    return simd_level;
+#elif defined(__SSE2__)
+    return SimdLevel::sse2;
+#else
+    return SimdLevel::scalar;
+#endif
+}
+
+void VoxelGridInterface::GetEnclosingVoxelIDs(const Eigen::Vector3f* points, const size_t num_points, VoxelID* voxel_ids) const {
+    GetEnclosingVoxelIDs(points, num_points, voxel_ids, GetSupportedSimdLevel());
+}
+
+void VoxelGridInterface::GetEnclosingVoxelIDs(const Eigen::Vector3f* points, const size_t num_points, VoxelID* voxel_ids,
+                                              const SimdLevel simd_level) const {
+    static_assert(sizeof(Eigen::Vector3f) == 3 * sizeof(float), "Eigen::Vector3f is not packed");
+    if (num_points == 0)
+        return;
+#if defined(__SSE2__)
+    const VoxelLattice lattice = {
+        { grid_min_[0], grid_min_[1], grid_min_[2] },
+        { grid_max_[0], grid_max_[1], grid_max_[2] },
+        inverse_voxel_size_,
+        { voxels_per_dim_[0], voxels_per_dim_[1], voxels_per_dim_[2] }
+    };
+    switch (simd_level) {
+#if defined(CLASSY_VOXELIZER_AVX2)
+    case SimdLevel::avx2:
+        // a face's corners would be mostly padding in 8 lanes
+        if (num_points <= 4) {
+            ForEachPointBlock<4>(points[0].data(), num_points, lattice, voxel_ids, GetVoxelIDsSSE2);
+            return;
         }
+        ForEachPointBlock<8>(points[0].data(), num_points, lattice, voxel_ids, GetVoxelIDsAVX2);
+        return;
+#endif
+    case SimdLevel::sse2:
+        ForEachPointBlock<4>(points[0].data(), num_points, lattice, voxel_ids, GetVoxelIDsSSE2);
+        return;
+    default:
+        break;
+    }
+#endif
+    for (size_t i = 0; i < num_points; i++) {
+        Eigen::Vector3i voxel;
+        voxel_ids[i] = GetEnclosingVoxel(points[i], voxel) ? GetVoxelID(voxel) : kVoxelOutOfGrid;
     }
-    return numOccupied;
 }
 
-unsigned int VoxelGridInterface::GetEnclosingVoxelID(const Eigen::Vector3f& vertex) const {
+VoxelID VoxelGridInterface::GetEnclosingVoxelID(const Eigen::Vector3f& vertex) const {
+    Eigen::Vector3i voxel;
+    if (!GetEnclosingVoxel(vertex, voxel))
+        return kVoxelOutOfGrid;
+    return GetVoxelID(voxel);
+}
+
+bool VoxelGridInterface::GetEnclosingVoxel(const Eigen::Vector3f& vertex, Eigen::Vector3i& voxel) const {
     if (vertex[0] < grid_min_[0] ||
         vertex[1] < grid_min_[1] ||
         vertex[2] < grid_min_[2] ||
         vertex[0] > grid_max_[0] ||
         vertex[1] > grid_max_[1] ||
         vertex[2] > grid_max_[2])
-        return -1;
+        return false;
     
-    const Eigen::Vector3f vertex_offset_discretized = (vertex - grid_min_) / voxel_size_;
-    const float result = voxels_per_dim_[0] * voxels_per_dim_[1] *
-                         std::floor(vertex_offset_discretized[2]) + voxels_per_dim_[0] *
-                         std::floor(vertex_offset_discretized[1]) + std::floor(vertex_offset_discretized[0]);
-    return static_cast<unsigned int>(result);
+    // a multiplication, which the batched versions reproduce exactly, unlike
+    // the reciprocal approximations -Ofast may turn a division into
+    const Eigen::Vector3f vertex_offset_discretized = (vertex - grid_min_) * inverse_voxel_size_;
+    for (int i = 0; i < 3; i++) {
+        // offsets are non-negative past the bounds check, so truncating floors. The
+        // grid is truncated to whole voxels, the remainder up to grid_max_ is outside
+        voxel[i] = static_cast<int>(vertex_offset_discretized[i]);
+        if (voxel[i] >= voxels_per_dim_[i])
+            return false;
+    }
+    return true;
+}
+
+VoxelID VoxelGridInterface::GetVoxelID(const Eigen::Vector3i& voxel) const {
+    return (static_cast<VoxelID>(voxel[2]) * voxels_per_dim_[1] + voxel[1]) * voxels_per_dim_[0] + voxel[0];
+}
+
+Eigen::Vector3i VoxelGridInterface::GetVoxel(const VoxelID voxel_id) const {
+    const VoxelID voxels_per_plane = static_cast<VoxelID>(voxels_per_dim_[0]) * voxels_per_dim_[1];
+    return Eigen::Vector3i(static_cast<int>(voxel_id % voxels_per_dim_[0]),
+                           static_cast<int>((voxel_id % voxels_per_plane) / voxels_per_dim_[0]),
+                           static_cast<int>(voxel_id / voxels_per_plane));
 }
 
 const Eigen::Vector3i& VoxelGridInterface::GetVoxelsPerDim() const {
     return voxels_per_dim_;
 }
 
-void VoxelGridInterface::SaveAsPLY(const std::string& filepath) const {
-    const unsigned int num_occupied_voxels = GetNumOccupiedVoxels();
-    std::vector<float> vertices(num_occupied_voxels * 3);
-    std::vector<uint8_t> colors(num_occupied_voxels * 4);
-    std::vector<int> labels(num_occupied_voxels * 4);
-    unsigned int raw_vertex_i = 0;
-    unsigned int raw_color_i = 0;
-    unsigned int raw_label_i = 0;
-    for (int i = 0; i < voxels_per_dim_[0]; i++) {
-        for (int j = 0; j < voxels_per_dim_[1]; j++) {
-            for (int k = 0; k < voxels_per_dim_[2]; k++) {
-                const uint32_t voxel_id = static_cast<unsigned int>(voxels_per_dim_[0] *
-                                                                    voxels_per_dim_[1] * k +
-                                                                    voxels_per_dim_[0] * j + i);
-                if (IsVoxelOccupied(voxel_id)) {
-                    const Eigen::Vector3i& color = GetVoxelColor(voxel_id);
-                    int label = GetVoxelClass(voxel_id);
-                    Eigen::Vector3f voxel_pos((i * voxel_size_) + grid_min_[0] + voxel_size_ / 2,
-                                              (j * voxel_size_) + grid_min_[1] + voxel_size_ / 2,
-                                              (k * voxel_size_) + grid_min_[2] + voxel_size_ / 2);
-                    vertices[raw_vertex_i++] = voxel_pos[0];
-                    vertices[raw_vertex_i++] = voxel_pos[1];
-                    vertices[raw_vertex_i++] = voxel_pos[2];
-                    colors[raw_color_i++] = color[0];
-                    colors[raw_color_i++] = color[1];
-                    colors[raw_color_i++] = color[2];
-                    colors[raw_color_i++] = 255;
-                    labels[raw_label_i++] = label;
-                }
-            }
-        }
-    }
-    std::filebuf fb;
-    fb.open(filepath, std::ios::out | std::ios::binary);
-    std::ostream ss(&fb);
-    tinyply::PlyFile out_file;
-    out_file.add_properties_to_element("vertex", { "x", "y", "z" }, vertices);
-    out_file.add_properties_to_element("vertex", { "red", "green", "blue", "alpha" }, colors);
-    out_file.add_properties_to_element("vertex", { "label" }, labels);
-    out_file.write(ss, true);
-    fb.close();
+const Eigen::Vector3f& VoxelGridInterface::GetGridMin() const {
+    return grid_min_;
 }
 
+float VoxelGridInterface::GetVoxelSize() const {
+    return voxel_size_;
+}
+
+float VoxelGridInterface::GetInverseVoxelSize() const {
+    return inverse_voxel_size_;
+}
+
+void VoxelGridInterface::WritePointCloudHeader(BufferedFileWriter& file_out, const uint64_t num_voxels) {
+    // as tinyply writes it for SaveAsPLY, except for the padding after the count
+    file_out.Print("ply\n");
+    file_out.Print("format binary_little_endian 1.0\n");
+    file_out.Print("element vertex %-20llu\n", static_cast<unsigned long long>(num_voxels));
+    file_out.Print("property float x\n");
+    file_out.Print("property float y\n");
+    file_out.Print("property float z\n");
+    file_out.Print("property uchar red\n");
+    file_out.Print("property uchar green\n");
+    file_out.Print("property uchar blue\n");
+    file_out.Print("property uchar alpha\n");
+    file_out.Print("property int label\n");
+    file_out.Print("end_header\n");
+}
 
 /*void ClassyVoxelizer::WriteFace(std::vector<uint32_t>& local_faces,
  int& index,
@@ -131,108 +344,228 @@ void VoxelGridInterface::SaveAsPLY(const std::string& filepath) const {
  local_vertices[vertex_index++] = static_cast<float>(vertex[2]);
  }*/
 
-void VoxelGridInterface::WritePlyHeader(std::ofstream& file_out_, const int vertex, const int faces) const {
-    file_out_ << "ply" << std::endl;
-    file_out_ << "format ascii 1.0" << std::endl;
-    file_out_ << "element vertex " << vertex << std::endl;
-    file_out_ << "property float x" << std::endl;
-    file_out_ << "property float y" << std::endl;
-    file_out_ << "property float z" << std::endl;
-    file_out_ << "property float nx" << std::endl;
-    file_out_ << "property float ny" << std::endl;
-    file_out_ << "property float nz" << std::endl;
-    file_out_ << "property uchar red" << std::endl;
-    file_out_ << "property uchar green" << std::endl;
-    file_out_ << "property uchar blue" << std::endl;
-    file_out_ << "element face " << faces << std::endl;
-    file_out_ << "property list uchar int vertex_indices" << std::endl;
-    file_out_ << "end_header" << std::endl;
-}
-
-void VoxelGridInterface::WriteVertex(std::stringstream& vertices_,
+void VoxelGridInterface::WritePlyHeader(BufferedFileWriter& file_out, const PlyFormat format,
+                                        const uint64_t num_vertices, const uint64_t num_faces) const {
+    file_out.Print("ply\n");
+    file_out.Print((format == PlyFormat::binary) ? "format binary_little_endian 1.0\n" : "format ascii 1.0\n");
+    file_out.Print("element vertex %llu\n", static_cast<unsigned long long>(num_vertices));
+    file_out.Print("property float x\n");
+    file_out.Print("property float y\n");
+    file_out.Print("property float z\n");
+    file_out.Print("property float nx\n");
+    file_out.Print("property float ny\n");
+    file_out.Print("property float nz\n");
+    file_out.Print("property uchar red\n");
+    file_out.Print("property uchar green\n");
+    file_out.Print("property uchar blue\n");
+    file_out.Print("element face %llu\n", static_cast<unsigned long long>(num_faces));
+    file_out.Print("property list uchar int vertex_indices\n");
+    file_out.Print("end_header\n");
+}
+
+void VoxelGridInterface::WriteVertex(BufferedFileWriter& file_out, const PlyFormat format,
                                      const Eigen::Vector3f& pos, const Eigen::Vector3i& color) const {
-    vertices_ << pos[0] << " " << pos[1] << " " << pos[2] << " 0 0 0 " <<
-                 color[0] << " " << color[1] << " " << color[2] << std::endl;
+    if (format == PlyFormat::ascii) {
+        // %g matches the default float formatting of the previous iostream writer
+        file_out.Print("%g %g %g 0 0 0 %d %d %d\n", pos[0], pos[1], pos[2], color[0], color[1], color[2]);
+        return;
+    }
+    for (int i = 0; i < 3; i++)
+        file_out.WriteLittleEndian(pos[i]);
+    for (int i = 0; i < 3; i++)
+        file_out.WriteLittleEndian(0.0f);
+    for (int i = 0; i < 3; i++)
+        file_out.WriteLittleEndian(static_cast<uint8_t>(color[i]));
 }
 
-void VoxelGridInterface::WriteFace(std::stringstream& faces_,
-                                const int index1, const int index2, const int index3) const {
-    faces_ << "3 " << index1 << " " << index2 << " " << index3 << std::endl;
+void VoxelGridInterface::WriteFace(BufferedFileWriter& file_out, const PlyFormat format,
+                                   const int index1, const int index2, const int index3) const {
+    if (format == PlyFormat::ascii) {
+        file_out.Print("3 %d %d %d\n", index1, index2, index3);
+        return;
+    }
+    file_out.WriteLittleEndian(static_cast<uint8_t>(3));
+    file_out.WriteLittleEndian(static_cast<int32_t>(index1));
+    file_out.WriteLittleEndian(static_cast<int32_t>(index2));
+    file_out.WriteLittleEndian(static_cast<int32_t>(index3));
 }
 
-void VoxelGridInterface::SaveAsPLYMesh(const std::string& filepath) const {
+bool VoxelGridInterface::SaveAsPLYMesh(const std::string& filepath,
+                                       const PlyFormat format,
+                                       const MeshStyle style,
+                                       VoxelMeshStats* mesh_stats) const {
     if (filepath == "")
-        return;
-    const unsigned int num_occupied_voxels = GetNumOccupiedVoxels();
-    std::vector<float> vertices(num_occupied_voxels * 3);
-    std::vector<uint8_t> colors(num_occupied_voxels * 4);
-    std::vector<int> labels(num_occupied_voxels * 4);
-    Eigen::Vector3f point;
-    Eigen::Vector3i color;
-    std::stringstream faces_;
-    std::stringstream vertices_;
-    int counter_faces = 0;
-    int counter_vertices = 0;
-    int s = 0;
-    const float voxel_size = voxel_size_ / 2.0f * 0.95f;
+        return false;
+    // face indices are written as int32, cube corners must stay below that
+    if (style == MeshStyle::cubes && 8 * GetNumOccupied() > static_cast<uint64_t>(INT32_MAX)) {
+        std::cerr << "Error: " << GetNumOccupied() << " voxels are too many for a cube mesh, "
+                  << filepath << " is not written" << std::endl;
+        return false;
+    }
+    BufferedFileWriter file_out(filepath);
+    if (!file_out.IsOpen()) {
+        std::cerr << "Error: cannot write " << filepath << std::endl;
+        return false;
+    }
+    const uint64_t num_occupied_voxels = GetNumOccupied();
+    uint64_t num_vertices = 8 * num_occupied_voxels;
+    uint64_t num_faces = 12 * num_occupied_voxels;
+    if (style == MeshStyle::cubes) {
+        WriteCubeMesh(file_out, format);
+    } else if (!WriteSurfaceMesh(file_out, format, style == MeshStyle::greedy, num_vertices, num_faces)) {
+        std::cerr << "Error: " << num_vertices << " vertices are too many for a voxel mesh, "
+                  << filepath << " is not written" << std::endl;
+        file_out.Close();
+        std::remove(filepath.c_str());
+        return false;
+    }
+    if (!file_out.Close()) {
+        std::cerr << "Error: could not write all of " << filepath << std::endl;
+        return false;
+    }
+    if (mesh_stats != nullptr) {
+        mesh_stats->num_vertices = num_vertices;
+        mesh_stats->num_faces = num_faces;
+    }
+    return true;
+}
+
+void VoxelGridInterface::WriteCubeFaces(BufferedFileWriter& file_out, const PlyFormat format, const uint64_t num_cubes) const {
+    for (uint64_t s = 0; s < num_cubes; s++) {
+        // SaveAsPLYMesh rejects cube counts whose corners overflow int32
+        const int32_t offset = static_cast<int32_t>(8 * s);
+        WriteFace(file_out, format, offset, offset+1, offset+3);
+        WriteFace(file_out, format, offset+3, offset+2, offset+1);
+        WriteFace(file_out, format, offset+3, offset+2, offset+6);
+        WriteFace(file_out, format, offset+6, offset+7, offset+3);
+        WriteFace(file_out, format, offset+7, offset+6, offset+5);
+        WriteFace(file_out, format, offset+5, offset+4, offset+7);
+        WriteFace(file_out, format, offset+4, offset+5, offset+1);
+        WriteFace(file_out, format, offset+1, offset+0, offset+4);
+        WriteFace(file_out, format, offset+4, offset+0, offset+3);
+        WriteFace(file_out, format, offset+3, offset+7, offset+4);
+        WriteFace(file_out, format, offset+5, offset+6, offset+2);
+        WriteFace(file_out, format, offset+2, offset+1, offset+5);
+    }
+}
+
+// mesh vertices are shared between faces of the same color only, so every
+// vertex keeps a single color
+struct MeshVertexKey {
+    VoxelID corner_id;
+    uint32_t color;
+    bool operator==(const MeshVertexKey& other) const {
+        return corner_id == other.corner_id && color == other.color;
+    }
+};
+
+struct MeshVertexKeyHash {
+    size_t operator()(const MeshVertexKey& key) const {
+        return static_cast<size_t>((key.corner_id * 0x9E3779B97F4A7C15ull) ^ key.color);
+    }
+};
+
+bool VoxelGridInterface::WriteSurfaceMesh(BufferedFileWriter& file_out, const PlyFormat format, const bool merge_faces,
+                                          uint64_t& num_vertices, uint64_t& num_faces) const {
+    std::vector<VoxelFace> faces[6];
+    GetSurfaceFaces(faces);
     
-    std::ofstream file_out_;
-    file_out_.open(filepath);
+    std::vector<Eigen::Vector3f> vertices;
+    std::vector<uint32_t> vertex_colors;
+    std::vector<uint32_t> triangles;
+    std::unordered_map<MeshVertexKey, uint32_t, MeshVertexKeyHash> vertex_index;
+    const Eigen::Vector3i corners_per_dim = voxels_per_dim_ + Eigen::Vector3i::Ones();
+    auto add_vertex = [&](const Eigen::Vector3i& corner, const uint32_t color) {
+        const VoxelID corner_id = (static_cast<VoxelID>(corner[2]) * corners_per_dim[1] + corner[1]) *
+                                  corners_per_dim[0] + corner[0];
+        const auto inserted = vertex_index.insert({{corner_id, color}, static_cast<uint32_t>(vertices.size())});
+        if (inserted.second) {
+            vertices.push_back(grid_min_ + corner.cast<float>() * voxel_size_);
+            vertex_colors.push_back(color);
+        }
+        return inserted.first->second;
+    };
     
-    for (int i = 0; i < voxels_per_dim_[0]; i++) {
-        for (int j = 0; j < voxels_per_dim_[1]; j++) {
-            for (int k = 0; k < voxels_per_dim_[2]; k++) {
-                const uint32_t voxel_id = static_cast<unsigned int>(voxels_per_dim_[0] *
-                                                                    voxels_per_dim_[1] * k +
-                                                                    voxels_per_dim_[0] * j + i);
-                if (IsVoxelOccupied(voxel_id)) {
-                    const Eigen::Vector3i& color = GetVoxelColor(voxel_id);
-                    Eigen::Vector3f point((i * voxel_size_) + grid_min_[0] + voxel_size_ / 2,
-                                          (j * voxel_size_) + grid_min_[1] + voxel_size_ / 2,
-                                          (k * voxel_size_) + grid_min_[2] + voxel_size_ / 2);
-                    const int offset = 8*s;
-                    WriteFace(faces_, offset, offset+1, offset+3);
-                    WriteFace(faces_, offset+3, offset+2, offset+1);
-                    WriteFace(faces_, offset+3, offset+2, offset+6);
-                    WriteFace(faces_, offset+6, offset+7, offset+3);
-                    WriteFace(faces_, offset+7, offset+6, offset+5);
-                    WriteFace(faces_, offset+5, offset+4, offset+7);
-                    WriteFace(faces_, offset+4, offset+5, offset+1);
-                    WriteFace(faces_, offset+1, offset+0, offset+4);
-                    WriteFace(faces_, offset+4, offset+0, offset+3);
-                    WriteFace(faces_, offset+3, offset+7, offset+4);
-                    WriteFace(faces_, offset+5, offset+6, offset+2);
-                    WriteFace(faces_, offset+2, offset+1, offset+5);
-                    counter_faces += 12;
-                    
-                    Eigen::Vector3f p1(-voxel_size + point[0], voxel_size + point[1], voxel_size + point[2]);
-                    Eigen::Vector3f p2(-voxel_size + point[0], voxel_size + point[1], -voxel_size + point[2]);
-                    Eigen::Vector3f p3(voxel_size + point[0], voxel_size + point[1], -voxel_size + point[2]);
-                    
-                    WriteVertex(vertices_, p1, color);
-                    WriteVertex(vertices_, p2, color);
-                    WriteVertex(vertices_, p3, color);
-                    WriteVertex(vertices_,
-                                Eigen::Vector3f(voxel_size + point[0], voxel_size + point[1], voxel_size + point[2]), color);
-                    WriteVertex(vertices_,
-                                Eigen::Vector3f(-voxel_size + point[0], -voxel_size + point[1], voxel_size + point[2]), color);
-                    WriteVertex(vertices_,
-                                Eigen::Vector3f(-voxel_size + point[0], -voxel_size + point[1], -voxel_size + point[2]), color);
-                    WriteVertex(vertices_,
-                                Eigen::Vector3f(voxel_size + point[0], -voxel_size + point[1], -voxel_size + point[2]), color);
-                    WriteVertex(vertices_,
-                                Eigen::Vector3f(voxel_size + point[0], -voxel_size + point[1], voxel_size + point[2]), color);
-                    counter_vertices += 8;
-                    s++;
+    for (int direction = 0; direction < 6; direction++) {
+        const int axis = direction / 2;
+        const int u_axis = (axis + 1) % 3;
+        const int v_axis = (axis + 2) % 3;
+        const bool positive = (direction % 2 == 0);
+        std::vector<VoxelFace>& slice_faces = faces[direction];
+        std::sort(slice_faces.begin(), slice_faces.end());
+        
+        // faces of the current slice by (v, u), mapped to their index
+        std::unordered_map<uint64_t, size_t> face_at;
+        std::vector<bool> merged(slice_faces.size(), false);
+        auto face_key = [](const int v, const int u) { return static_cast<uint64_t>(v) << 32 | static_cast<uint32_t>(u); };
+        auto can_merge = [&](const int v, const int u, const uint32_t color) {
+            const auto face = face_at.find(face_key(v, u));
+            return face != face_at.end() && !merged[face->second] && slice_faces[face->second].color == color;
+        };
+        
+        for (size_t slice_begin = 0; slice_begin < slice_faces.size();) {
+            size_t slice_end = slice_begin;
+            while (slice_end < slice_faces.size() && slice_faces[slice_end].slice == slice_faces[slice_begin].slice)
+                slice_end++;
+            if (merge_faces) {
+                face_at.clear();
+                for (size_t i = slice_begin; i < slice_end; i++)
+                    face_at[face_key(slice_faces[i].v, slice_faces[i].u)] = i;
+            }
+            for (size_t i = slice_begin; i < slice_end; i++) {
+                if (merged[i])
+                    continue;
+                const VoxelFace& face = slice_faces[i];
+                int width = 1;
+                int height = 1;
+                if (merge_faces) {
+                    // grow along u, then add rows along v while they are complete
+                    merged[i] = true;
+                    while (can_merge(face.v, face.u + width, face.color))
+                        merged[face_at[face_key(face.v, face.u + width++)]] = true;
+                    for (bool complete = true; complete; ) {
+                        for (int j = 0; j < width && complete; j++)
+                            complete = can_merge(face.v + height, face.u + j, face.color);
+                        if (!complete)
+                            break;
+                        for (int j = 0; j < width; j++)
+                            merged[face_at[face_key(face.v + height, face.u + j)]] = true;
+                        height++;
+                    }
+                }
+                
+                Eigen::Vector3i corner;
+                corner[axis] = face.slice + (positive ? 1 : 0);
+                uint32_t quad[4];
+                const int corner_u[4] = {0, width, width, 0};
+                const int corner_v[4] = {0, 0, height, height};
+                for (int c = 0; c < 4; c++) {
+                    corner[u_axis] = face.u + corner_u[c];
+                    corner[v_axis] = face.v + corner_v[c];
+                    quad[c] = add_vertex(corner, face.color);
                 }
+                // counter-clockwise seen from outside
+                if (positive)
+                    triangles.insert(triangles.end(), {quad[0], quad[1], quad[2], quad[0], quad[2], quad[3]});
+                else
+                    triangles.insert(triangles.end(), {quad[0], quad[2], quad[1], quad[0], quad[3], quad[2]});
             }
+            slice_begin = slice_end;
         }
+        std::vector<VoxelFace>().swap(slice_faces);
     }
-    WritePlyHeader(file_out_, counter_vertices, counter_faces);
-    file_out_ << vertices_.str() << faces_.str();
-    file_out_.close();
-}
-
-int VoxelGridInterface::GetVoxelClass(const uint32_t voxel_id) const {
-    return 0;
+    
+    num_vertices = vertices.size();
+    num_faces = triangles.size() / 3;
+    // face indices are written as int32, as for cubes
+    if (num_vertices > static_cast<uint64_t>(INT32_MAX))
+        return false;
+    WritePlyHeader(file_out, format, num_vertices, num_faces);
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const Eigen::Vector3i color((vertex_colors[i] >> 16) & 0xFF, (vertex_colors[i] >> 8) & 0xFF, vertex_colors[i] & 0xFF);
+        WriteVertex(file_out, format, vertices[i], color);
+    }
+    for (size_t i = 0; i < triangles.size(); i+=3)
+        WriteFace(file_out, format, triangles[i], triangles[i+1], triangles[i+2]);
+    return true;
 }
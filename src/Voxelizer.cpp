@@ -9,6 +9,28 @@
 #include "Voxelizer.h"
 #include "VoxelGrid.h"
 
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+void Voxelizer::SetNumThreads(const int num_threads) {
+    num_threads_ = std::max(1, num_threads);
+}
+
+void Voxelizer::SetMethod(const VoxelizationMethod method) {
+    method_ = method;
+}
+
+void Voxelizer::SetVerbose(const bool verbose) {
+    verbose_ = verbose;
+}
+
+const VoxelizeStats& Voxelizer::GetStats() const {
+    return stats_;
+}
+
 Eigen::Vector3f Voxelizer::GetMidpoint(const Eigen::Vector3f& v1, const Eigen::Vector3f& v2) const {
     return (v1 + v2) / 2;
 }
@@ -23,31 +45,31 @@ const float Voxelizer::AreaOfTriangle(const Eigen::Vector3f& v1,
     return (v2 - v1).cross(v3 - v1).norm() / 2.0;
 }
 
-int Voxelizer::SplitBaseFace(const VoxelGridInterface& voxel_grid,
-                             std::vector<Eigen::Vector3f>& vertices,
-                             std::vector<uint32_t>& face,
-                             std::vector<uint32_t>& sub_faces,
-                             std::vector<uint32_t>& first_sub_face,
-                             std::vector<uint32_t>& second_sub_face) const {
+template <typename VertexArray>
+int Voxelizer::SplitBaseFaceImpl(const VoxelGridInterface& voxel_grid,
+                                 VertexArray& vertices,
+                                 const Face& face,
+                                 Face& first_sub_face,
+                                 Face& second_sub_face) const {
     
-    if (AreaOfTriangle(vertices[face[0]], vertices[face[1]], vertices[face[2]]) < kVoxelizerMinTriangleArea) {
-        sub_faces.insert(sub_faces.end(), face.begin(), face.end());
+    if (AreaOfTriangle(vertices[face[0]], vertices[face[1]], vertices[face[2]]) < kVoxelizerMinTriangleArea)
         return -1;
-    }
     
-    std::vector<double> side_lengths(3,0);
+    const Eigen::Vector3f corners[3] = { vertices[face[0]], vertices[face[1]], vertices[face[2]] };
+    VoxelID corner_voxel_ids[3];
+    voxel_grid.GetEnclosingVoxelIDs(corners, 3, corner_voxel_ids);
+    
+    double side_lengths[3] = { 0, 0, 0 };
     bool single_voxel_triangle = true;
     for (int i = 0; i < 3; i++) {
-        if (voxel_grid.GetEnclosingVoxelID(vertices[face[i % 3]]) != voxel_grid.GetEnclosingVoxelID(vertices[face[(i + 1) % 3]])) {
+        if (corner_voxel_ids[i] != corner_voxel_ids[(i + 1) % 3]) {
             side_lengths[i] = EuclideanDistance(vertices[face[i % 3]], vertices[face[(i + 1) % 3]]);
             single_voxel_triangle = false;
         }
     }
     
-    if (single_voxel_triangle) {
-        sub_faces.insert(sub_faces.end(), face.begin(), face.end());
+    if (single_voxel_triangle)
         return -1;
-    }
     
     int longest_i = 0;
     double longest_length = 0;
@@ -71,3 +93,180 @@ int Voxelizer::SplitBaseFace(const VoxelGridInterface& voxel_grid,
     
     return longest_i;
 }
+
+int Voxelizer::SplitBaseFace(const VoxelGridInterface& voxel_grid,
+                             std::vector<Eigen::Vector3f>& vertices,
+                             const Face& face,
+                             Face& first_sub_face,
+                             Face& second_sub_face) const {
+    return SplitBaseFaceImpl(voxel_grid, vertices, face, first_sub_face, second_sub_face);
+}
+
+int Voxelizer::SplitBaseFace(const VoxelGridInterface& voxel_grid,
+                             ScratchArray<Eigen::Vector3f>& vertices,
+                             const Face& face,
+                             Face& first_sub_face,
+                             Face& second_sub_face) const {
+    return SplitBaseFaceImpl(voxel_grid, vertices, face, first_sub_face, second_sub_face);
+}
+
+size_t Voxelizer::GetNumFaceChunks(const size_t num_faces) const {
+    // several chunks per thread so a few huge triangles don't stall one worker
+    const size_t num_chunks = std::max<size_t>(10, 16 * num_threads_);
+    return std::max<size_t>(1, std::min(num_faces, num_chunks));
+}
+
+double Voxelizer::ForEachFaceChunk(const size_t num_faces, const FaceChunkFunction& process_chunk) const {
+    const size_t num_chunks = GetNumFaceChunks(num_faces);
+    std::atomic<size_t> next_chunk(0);
+    std::mutex progress_mutex;
+    size_t num_done = 0;
+    int printed_percent = 0;
+    double seconds = 0;
+    
+    auto worker = [&]() {
+        for (size_t chunk_i = next_chunk++; chunk_i < num_chunks; chunk_i = next_chunk++) {
+            const auto start = std::chrono::steady_clock::now();
+            process_chunk(chunk_i, num_faces * chunk_i / num_chunks, num_faces * (chunk_i + 1) / num_chunks);
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            seconds += elapsed.count();
+            const int percent = static_cast<int>(10 * ++num_done / num_chunks);
+            for (; verbose_ && printed_percent < std::min(percent, 9); printed_percent++)
+                std::cout << printed_percent + 1 << "0% " << std::flush;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < num_threads_; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread: threads)
+        thread.join();
+    return seconds;
+}
+
+// separating axis test (Akenine-Moeller): box normals, triangle normal and the
+// nine cross products of box normals and triangle edges
+bool Voxelizer::TriangleOverlapsBox(const Eigen::Vector3f& box_center,
+                                    const Eigen::Vector3f& box_half_size,
+                                    const Eigen::Vector3f& v1,
+                                    const Eigen::Vector3f& v2,
+                                    const Eigen::Vector3f& v3) const {
+    const Eigen::Vector3f p1 = v1 - box_center;
+    const Eigen::Vector3f p2 = v2 - box_center;
+    const Eigen::Vector3f p3 = v3 - box_center;
+    const Eigen::Vector3f edges[3] = { p2 - p1, p3 - p2, p1 - p3 };
+    
+    auto separated_along = [&](const Eigen::Vector3f& axis) {
+        const float d1 = axis.dot(p1);
+        const float d2 = axis.dot(p2);
+        const float d3 = axis.dot(p3);
+        const float radius = box_half_size.dot(axis.cwiseAbs());
+        return std::min(d1, std::min(d2, d3)) > radius || std::max(d1, std::max(d2, d3)) < -radius;
+    };
+    
+    for (int i = 0; i < 3; i++) {
+        if (separated_along(Eigen::Vector3f::Unit(i)))
+            return false;
+        for (int j = 0; j < 3; j++) {
+            const Eigen::Vector3f axis = Eigen::Vector3f::Unit(i).cross(edges[j]);
+            if (!axis.isZero(0) && separated_along(axis))
+                return false;
+        }
+    }
+    return !separated_along(edges[0].cross(edges[1]));
+}
+
+// closest point on a triangle, Ericson, Real-Time Collision Detection 5.1.5
+Eigen::Vector3f Voxelizer::GetClosestPointBarycentric(const Eigen::Vector3f& point,
+                                                      const Eigen::Vector3f& v1,
+                                                      const Eigen::Vector3f& v2,
+                                                      const Eigen::Vector3f& v3) const {
+    const Eigen::Vector3f ab = v2 - v1;
+    const Eigen::Vector3f ac = v3 - v1;
+    const Eigen::Vector3f ap = point - v1;
+    const float d1 = ab.dot(ap);
+    const float d2 = ac.dot(ap);
+    if (d1 <= 0 && d2 <= 0)
+        return Eigen::Vector3f(1, 0, 0);
+    
+    const Eigen::Vector3f bp = point - v2;
+    const float d3 = ab.dot(bp);
+    const float d4 = ac.dot(bp);
+    if (d3 >= 0 && d4 <= d3)
+        return Eigen::Vector3f(0, 1, 0);
+    
+    const float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0 && d1 != d3) {
+        const float v = d1 / (d1 - d3);
+        return Eigen::Vector3f(1 - v, v, 0);
+    }
+    
+    const Eigen::Vector3f cp = point - v3;
+    const float d5 = ab.dot(cp);
+    const float d6 = ac.dot(cp);
+    if (d6 >= 0 && d5 <= d6)
+        return Eigen::Vector3f(0, 0, 1);
+    
+    const float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0 && d2 != d6) {
+        const float w = d2 / (d2 - d6);
+        return Eigen::Vector3f(1 - w, 0, w);
+    }
+    
+    const float va = d3 * d6 - d5 * d4;
+    if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0 && (d4 - d3) + (d5 - d6) != 0) {
+        const float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        return Eigen::Vector3f(0, 1 - w, w);
+    }
+    
+    const float denom = va + vb + vc;
+    if (denom == 0)
+        return Eigen::Vector3f(1, 0, 0);
+    const float v = vb / denom;
+    const float w = vc / denom;
+    return Eigen::Vector3f(1 - v - w, v, w);
+}
+
+void Voxelizer::RasterizeFace(const VoxelGridInterface& voxel_grid,
+                              const Eigen::Vector3f& v1,
+                              const Eigen::Vector3f& v2,
+                              const Eigen::Vector3f& v3,
+                              std::vector<VoxelSample>& samples) const {
+    samples.clear();
+    const float voxel_size = voxel_grid.GetVoxelSize();
+    const float inverse_voxel_size = voxel_grid.GetInverseVoxelSize();
+    const Eigen::Vector3f& grid_min = voxel_grid.GetGridMin();
+    const Eigen::Vector3i& voxels_per_dim = voxel_grid.GetVoxelsPerDim();
+    const Eigen::Vector3f face_min = v1.cwiseMin(v2).cwiseMin(v3);
+    const Eigen::Vector3f face_max = v1.cwiseMax(v2).cwiseMax(v3);
+    
+    // voxel ranges as GetEnclosingVoxel computes them, floored for corners
+    // outside the grid
+    Eigen::Vector3i first_voxel;
+    Eigen::Vector3i last_voxel;
+    for (int i = 0; i < 3; i++) {
+        first_voxel[i] = static_cast<int>(std::floor((face_min[i] - grid_min[i]) * inverse_voxel_size));
+        last_voxel[i] = static_cast<int>(std::floor((face_max[i] - grid_min[i]) * inverse_voxel_size));
+        if (last_voxel[i] < 0 || first_voxel[i] >= voxels_per_dim[i])
+            return;
+        first_voxel[i] = std::max(first_voxel[i], 0);
+        last_voxel[i] = std::min(last_voxel[i], voxels_per_dim[i] - 1);
+    }
+    
+    const Eigen::Vector3f half_size = Eigen::Vector3f::Constant(voxel_size / 2);
+    Eigen::Vector3i voxel;
+    for (voxel[2] = first_voxel[2]; voxel[2] <= last_voxel[2]; voxel[2]++) {
+        for (voxel[1] = first_voxel[1]; voxel[1] <= last_voxel[1]; voxel[1]++) {
+            for (voxel[0] = first_voxel[0]; voxel[0] <= last_voxel[0]; voxel[0]++) {
+                const Eigen::Vector3f center = grid_min + (voxel.cast<float>() * voxel_size) + half_size;
+                if (!TriangleOverlapsBox(center, half_size, v1, v2, v3))
+                    continue;
+                VoxelSample sample;
+                sample.voxel_id = voxel_grid.GetVoxelID(voxel);
+                sample.barycentric = GetClosestPointBarycentric(center, v1, v2, v3);
+                samples.push_back(sample);
+            }
+        }
+    }
+}
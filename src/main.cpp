@@ -6,20 +6,177 @@
  See LICENSE at package root for full license
  */
 
+#include <exception>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <string>
+#include <vector>
 
+#include "BatchVoxelizer.h"
 #include "ClassyVoxelizer.h"
 
+// whole numbers only, false for anything else or out of range
+static bool ParseInt(const std::string& text, int& value) {
+    try {
+        size_t size = 0;
+        value = std::stoi(text, &size);
+        return size == text.size();
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+static bool ParseFloat(const std::string& text, float& value) {
+    try {
+        size_t size = 0;
+        value = std::stof(text, &size);
+        return size == text.size();
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+// value of the choice named text, false if there is none. The choices are
+// given per call, so T is deduced from value
+template <typename T>
+static bool ParseChoice(const std::string& text, const std::map<std::string, T>& choices, T& value) {
+    const auto choice = choices.find(text);
+    if (choice == choices.end())
+        return false;
+    value = choice->second;
+    return true;
+}
+
 int main (int argc, char* argv[]) {
-    if (argc < 5) {
+    std::vector<std::string> args;
+    int num_threads = 1;
+    VoxelizationMethod method = VoxelizationMethod::split;
+    VoxelStorage storage = VoxelStorage::dense;
+    VoxelFormat output_format = VoxelFormat::ply;
+    PlyFormat mesh_format = PlyFormat::binary;
+    MeshStyle mesh_style = MeshStyle::cubes;
+    bool mapped_input = true;
+    VoxelAggregation aggregation = VoxelAggregation::last;
+    bool batch = false;
+    int num_jobs = 1;
+    int chunk_size = 0;
+    int memory_budget_mb = 0;
+    std::string report_file;
+    // options with a missing, unknown or out of range value are rejected
+    // rather than falling back to their defaults
+    bool valid = true;
+    for (int i = 1; i < argc && valid; i++) {
+        const std::string arg(argv[i]);
+        const bool has_value = (i + 1 < argc);
+        if (arg == "--threads" && has_value)
+            valid = ParseInt(argv[++i], num_threads) && num_threads >= 1;
+        else if (arg == "--method" && has_value)
+            valid = ParseChoice(argv[++i], {{"split", VoxelizationMethod::split},
+                                            {"raster", VoxelizationMethod::raster}}, method);
+        else if (arg == "--grid" && has_value)
+            valid = ParseChoice(argv[++i], {{"dense", VoxelStorage::dense},
+                                            {"sparse", VoxelStorage::sparse},
+                                            {"atomic", VoxelStorage::atomic}}, storage);
+        else if (arg == "--output-format" && has_value)
+            valid = ParseChoice(argv[++i], {{"ply", VoxelFormat::ply}, {"cvox", VoxelFormat::cvox}}, output_format);
+        else if (arg == "--mesh-format" && has_value)
+            valid = ParseChoice(argv[++i], {{"binary", PlyFormat::binary}, {"ascii", PlyFormat::ascii}}, mesh_format);
+        else if (arg == "--aggregate" && has_value)
+            valid = ParseChoice(argv[++i], {{"last", VoxelAggregation::last},
+                                            {"majority", VoxelAggregation::majority}}, aggregation);
+        else if (arg == "--jobs" && has_value)
+            valid = ParseInt(argv[++i], num_jobs) && num_jobs >= 1;
+        else if (arg == "--chunk-size" && has_value)
+            valid = ParseInt(argv[++i], chunk_size) && chunk_size >= 0;
+        else if (arg == "--memory-budget" && has_value)
+            valid = ParseInt(argv[++i], memory_budget_mb) && memory_budget_mb >= 0;
+        else if (arg == "--report" && has_value)
+            report_file = argv[++i];
+        else if (arg == "--batch")
+            batch = true;
+        else if (arg == "--input" && has_value)
+            valid = ParseChoice(argv[++i], {{"mmap", true}, {"stream", false}}, mapped_input);
+        else if (arg == "--mesh-style" && has_value)
+            valid = ParseChoice(argv[++i], {{"cubes", MeshStyle::cubes},
+                                            {"surface", MeshStyle::surface},
+                                            {"greedy", MeshStyle::greedy}}, mesh_style);
+        else if (arg.compare(0, 2, "--") == 0)
+            valid = false;
+        else
+            args.push_back(arg);
+    }
+    // comma-separated voxel sizes are voxelized from a single subdivision pass
+    std::vector<float> voxel_sizes;
+    VoxelType voxel_type = VoxelType::label;
+    if (valid && args.size() >= 4) {
+        std::istringstream voxel_size_list(args[2]);
+        for (std::string voxel_size; std::getline(voxel_size_list, voxel_size, ',') && valid;) {
+            voxel_sizes.push_back(0);
+            valid = ParseFloat(voxel_size, voxel_sizes.back()) && voxel_sizes.back() > 0;
+        }
+        valid = valid && !voxel_sizes.empty() &&
+                ParseChoice(args[3], {{"class", VoxelType::label}, {"color", VoxelType::color}}, voxel_type);
+    }
+    if (!valid || args.size() < 4 || args.size() > 5) {
         const std::string usage_message =
-            "\nUsage:\n\n./classyvoxelizer <input> <output> <voxel_size> <class/color> <voxel_mesh_output>\n";
+            "\nUsage:\n\n./classyvoxelizer <input> <output> <voxel_size[,voxel_size...]> <class/color> <voxel_mesh_output>"
+            " [--threads N] [--method split/raster]"
+            " [--grid dense/sparse/atomic] [--output-format ply/cvox] [--mesh-format binary/ascii]"
+            " [--mesh-style cubes/surface/greedy] [--input mmap/stream]"
+            " [--aggregate last/majority] [--chunk-size N] [--memory-budget MB] [--report <report.json>]\n"
+            "\n./classyvoxelizer --batch <input_dir/manifest> <output_dir> <voxel_size[,voxel_size...]> <class/color> <voxel_mesh_output_dir>"
+            " [--jobs N] [options above]\n";
         std::cout << usage_message << std::endl;
+        // no arguments at all just asks for the usage
+        return (argc == 1) ? 0 : 1;
+    }
+    if (args.size() >= 5 && (chunk_size > 0 || memory_budget_mb > 0)) {
+        std::cerr << "Error: voxel meshes cannot be written with --chunk-size or --memory-budget" << std::endl;
+        return 1;
+    }
+    auto create_voxelizer = [&]() {
+        std::unique_ptr<ClassyVoxelizer> classy_voxelizer(new ClassyVoxelizer(voxel_sizes));
+        classy_voxelizer->SetNumThreads(num_threads);
+        classy_voxelizer->SetMethod(method);
+        classy_voxelizer->SetStorage(storage);
+        classy_voxelizer->SetOutputFormat(output_format);
+        classy_voxelizer->SetMeshFormat(mesh_format);
+        classy_voxelizer->SetMeshStyle(mesh_style);
+        classy_voxelizer->SetMappedInput(mapped_input);
+        classy_voxelizer->SetAggregation(aggregation);
+        classy_voxelizer->SetChunkSize(chunk_size);
+        classy_voxelizer->SetMemoryBudget(memory_budget_mb);
+        classy_voxelizer->SetVerbose(true);
+        return classy_voxelizer;
+    };
+    const std::string mesh_output = (args.size() >= 5) ? args[4] : "";
+    if (batch) {
+        BatchVoxelizer batch_voxelizer(create_voxelizer, num_jobs);
+        if (!batch_voxelizer.CollectInputs(args[0]) ||
+            !batch_voxelizer.Process(voxel_type, args[1], mesh_output, report_file, output_format))
+            return 1;
         return 0;
     }
-    ClassyVoxelizer classy_voxelizer(std::stod(argv[3]));
-    classy_voxelizer.Process(std::string(argv[4]) == "color" ? VoxelType::color : VoxelType::label,
-                             argv[1], argv[2], (argc >= 5) ? argv[5] : "");
-    return 0;
+    SceneStats stats;
+    try {
+        stats = create_voxelizer()->Process(voxel_type, args[0], args[1], mesh_output);
+    } catch (const std::exception& e) {
+        // malformed inputs surface as exceptions from the PLY reader
+        std::cerr << "Error: " << args[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+    // the causes were reported while processing, the exit code tells scripts
+    const std::string status = (stats.num_faces == 0) ? "no faces" : (!stats.outputs_written ? "write failed" : "ok");
+    if (!report_file.empty()) {
+        std::ofstream report(report_file);
+        if (!report) {
+            std::cerr << "Error: cannot write " << report_file << std::endl;
+            return 1;
+        }
+        ClassyVoxelizer::WriteReport(report, args[0], stats, status);
+        report << std::endl;
+    }
+    return (status == "ok") ? 0 : 1;
 }
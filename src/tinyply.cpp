@@ -105,24 +105,6 @@ void PlyFile::read_header_property(std::istream & is)
     get_elements().back().properties.emplace_back(is);
 }
 
-size_t PlyFile::skip_property_binary(const PlyProperty & property, std::istream & is)
-{
-    static std::vector<char> skip(PropertyTable[property.propertyType].stride);
-    if (property.isList)
-    {
-		size_t listSize = 0;
-		size_t dummyCount = 0;
-        read_property_binary(property.listType, &listSize, dummyCount, is);
-        for (size_t i = 0; i < listSize; ++i) is.read(skip.data(), PropertyTable[property.propertyType].stride);
-        return listSize;
-    }
-    else
-    {
-        is.read(skip.data(), PropertyTable[property.propertyType].stride);
-        return 0;
-    }
-}
-
 void PlyFile::skip_property_ascii(const PlyProperty & property, std::istream & is)
 {
     std::string skip;
@@ -135,24 +117,20 @@ void PlyFile::skip_property_ascii(const PlyProperty & property, std::istream & i
     else is >> skip;
 }
 
-void PlyFile::read_property_binary(PlyProperty::Type t, void * dest, size_t & destOffset, std::istream & is)
+void PlyFile::decode_property_binary(PlyProperty::Type t, void * dest, const char * src)
 {
-    static std::vector<char> src(PropertyTable[t].stride);
-    is.read(src.data(), PropertyTable[t].stride);
-
     switch (t)
     {
-        case PlyProperty::Type::INT8:       ply_cast<int8_t>(dest, src.data(), isBigEndian);        break;
-        case PlyProperty::Type::UINT8:      ply_cast<uint8_t>(dest, src.data(), isBigEndian);       break;
-        case PlyProperty::Type::INT16:      ply_cast<int16_t>(dest, src.data(), isBigEndian);       break;
-        case PlyProperty::Type::UINT16:     ply_cast<uint16_t>(dest, src.data(), isBigEndian);      break;
-        case PlyProperty::Type::INT32:      ply_cast<int32_t>(dest, src.data(), isBigEndian);       break;
-        case PlyProperty::Type::UINT32:     ply_cast<uint32_t>(dest, src.data(), isBigEndian);      break;
-        case PlyProperty::Type::FLOAT32:    ply_cast_float<float>(dest, src.data(), isBigEndian);   break;
-        case PlyProperty::Type::FLOAT64:    ply_cast_double<double>(dest, src.data(), isBigEndian); break;
+        case PlyProperty::Type::INT8:       ply_cast<int8_t>(dest, src, isBigEndian);        break;
+        case PlyProperty::Type::UINT8:      ply_cast<uint8_t>(dest, src, isBigEndian);       break;
+        case PlyProperty::Type::INT16:      ply_cast<int16_t>(dest, src, isBigEndian);       break;
+        case PlyProperty::Type::UINT16:     ply_cast<uint16_t>(dest, src, isBigEndian);      break;
+        case PlyProperty::Type::INT32:      ply_cast<int32_t>(dest, src, isBigEndian);       break;
+        case PlyProperty::Type::UINT32:     ply_cast<uint32_t>(dest, src, isBigEndian);      break;
+        case PlyProperty::Type::FLOAT32:    ply_cast_float<float>(dest, src, isBigEndian);   break;
+        case PlyProperty::Type::FLOAT64:    ply_cast_double<double>(dest, src, isBigEndian); break;
         case PlyProperty::Type::INVALID:    throw std::invalid_argument("invalid ply property");
     }
-    destOffset += PropertyTable[t].stride;
 }
 
 void PlyFile::read_property_ascii(PlyProperty::Type t, void * dest, size_t & destOffset, std::istream & is)
@@ -212,29 +190,45 @@ void PlyFile::write_binary_internal(std::ostream & os)
     isBinary = true;
     write_header(os);
 
+    std::vector<uint8_t> row;
     for (auto & e : elements)
     {
+        // Look the cursors up once per element rather than once per row, and
+        // assemble each row before handing it to the stream in one write
+        std::vector<DataCursor *> cursors;
+        std::vector<int> strides;
+        for (auto & p : e.properties)
+        {
+            cursors.push_back(userDataTable[make_key(e.name, p.name)].get());
+            strides.push_back(PropertyTable[p.propertyType].stride);
+        }
+
         for (size_t i = 0; i < e.size; ++i)
         {
-            for (auto & p : e.properties)
+            row.clear();
+            for (size_t pi = 0; pi < e.properties.size(); ++pi)
             {
-                auto & cursor = userDataTable[make_key(e.name, p.name)];
+                auto & p = e.properties[pi];
+                auto cursor = cursors[pi];
+                const int stride = strides[pi];
                 if (p.isList)
                 {
                     uint8_t listSize[4] = {0, 0, 0, 0};
                     memcpy(listSize, &p.listCount, sizeof(uint32_t));
-					size_t dummyCount = 0;
-                    write_property_binary(p.listType, os, listSize, dummyCount);
+                    row.insert(row.end(), listSize, listSize + PropertyTable[p.listType].stride);
                     for (int j = 0; j < p.listCount; ++j)
                     {
-                        write_property_binary(p.propertyType, os, (cursor->data + cursor->offset), cursor->offset);
+                        row.insert(row.end(), cursor->data + cursor->offset, cursor->data + cursor->offset + stride);
+                        cursor->offset += stride;
                     }
                 }
                 else
                 {
-                    write_property_binary(p.propertyType, os, (cursor->data + cursor->offset), cursor->offset);
+                    row.insert(row.end(), cursor->data + cursor->offset, cursor->data + cursor->offset + stride);
+                    cursor->offset += stride;
                 }
             }
+            os.write((char *)row.data(), row.size());
         }
     }
 }
@@ -303,17 +297,10 @@ void PlyFile::write_header(std::ostream & os)
 
 void PlyFile::read_internal(std::istream & is)
 {
-    std::function<void(PlyProperty::Type t, void * dest, size_t & destOffset, std::istream & is)> read;
-    std::function<void(const PlyProperty & property, std::istream & is)> skip;
     if (isBinary)
     {
-        read = [&](PlyProperty::Type t, void * dest, size_t & destOffset, std::istream & _is) { read_property_binary(t, dest, destOffset, _is); };
-        skip = [&](const PlyProperty & property, std::istream & _is) { skip_property_binary(property, _is); };
-    }
-    else
-    {
-        read = [&](PlyProperty::Type t, void * dest, size_t & destOffset, std::istream & _is) { read_property_ascii(t, dest, destOffset, _is); };
-        skip = [&](const PlyProperty & property, std::istream & _is) { skip_property_ascii(property, _is); };
+        read_binary_internal(is);
+        return;
     }
 
     for (auto & element : get_elements())
@@ -330,7 +317,7 @@ void PlyFile::read_internal(std::istream & is)
                         {
 							size_t listSize = 0;
 							size_t dummyCount = 0;
-                            read(property.listType, &listSize, dummyCount, is);
+                            read_property_ascii(property.listType, &listSize, dummyCount, is);
                             if (cursor->realloc == false)
                             {
                                 cursor->realloc = true;
@@ -338,17 +325,17 @@ void PlyFile::read_internal(std::istream & is)
                             }
                             for (size_t i = 0; i < listSize; ++i)
                             {
-                                read(property.propertyType, (cursor->data + cursor->offset), cursor->offset, is);
+                                read_property_ascii(property.propertyType, (cursor->data + cursor->offset), cursor->offset, is);
                             }
                         }
                         else
                         {
-                            read(property.propertyType, (cursor->data + cursor->offset), cursor->offset, is);
+                            read_property_ascii(property.propertyType, (cursor->data + cursor->offset), cursor->offset, is);
                         }
                     }
                     else
                     {
-                        skip(property, is);
+                        skip_property_ascii(property, is);
                     }
                 }
             }
@@ -357,3 +344,134 @@ void PlyFile::read_internal(std::istream & is)
     }
 }
 
+void PlyFile::read(const char * body, size_t size, const std::function<void(const char *)> & consumed)
+{
+    if (!isBinary) throw std::runtime_error("only binary ply can be read from memory");
+    const size_t consumedStep = 16 << 20;
+    size_t position = 0;
+    size_t nextConsumed = consumedStep;
+    auto take = [&](const size_t n) -> const char *
+    {
+        if (size - position < n) throw std::runtime_error("unexpected end of ply file");
+        if (position >= nextConsumed)
+        {
+            if (consumed) consumed(body + position);
+            nextConsumed = position + consumedStep;
+        }
+        const char * src = body + position;
+        position += n;
+        return src;
+    };
+    decode_binary_internal(take);
+}
+
+void PlyFile::read_binary_internal(std::istream & is)
+{
+    // The body is read in large blocks and decoded from memory rather than
+    // with one istream read per scalar
+    std::vector<char> block(1 << 20);
+    size_t blockBegin = 0;
+    size_t blockEnd = 0;
+    auto take = [&](const size_t n) -> const char *
+    {
+        if (blockEnd - blockBegin < n)
+        {
+            const size_t remaining = blockEnd - blockBegin;
+            if (n > block.size()) block.resize(n);
+            memmove(block.data(), block.data() + blockBegin, remaining);
+            is.read(block.data() + remaining, block.size() - remaining);
+            blockBegin = 0;
+            blockEnd = remaining + is.gcount();
+            if (blockEnd < n) throw std::runtime_error("unexpected end of ply file");
+        }
+        const char * src = block.data() + blockBegin;
+        blockBegin += n;
+        return src;
+    };
+    decode_binary_internal(take);
+}
+
+template<typename TakeFunction>
+void PlyFile::decode_binary_internal(TakeFunction & take)
+{
+    // little-endian values of the destination type are plain copies
+    auto decode = [&](const PlyProperty::Type t, const int stride, uint8_t * dest, const char * src)
+    {
+        if (isBigEndian) decode_property_binary(t, dest, src);
+        else if (stride == 4) memcpy(dest, src, 4);
+        else if (stride == 1) *dest = *src;
+        else if (stride == 2) memcpy(dest, src, 2);
+        else memcpy(dest, src, 8);
+    };
+    auto decode_size = [&](const PlyProperty::Type t, const char * src)
+    {
+        switch (t)
+        {
+            case PlyProperty::Type::INT8:
+            case PlyProperty::Type::UINT8:      { uint8_t v; ply_cast<uint8_t>(&v, src, isBigEndian); return size_t(v); }
+            case PlyProperty::Type::INT16:
+            case PlyProperty::Type::UINT16:     { uint16_t v; ply_cast<uint16_t>(&v, src, isBigEndian); return size_t(v); }
+            case PlyProperty::Type::INT32:
+            case PlyProperty::Type::UINT32:     { uint32_t v; ply_cast<uint32_t>(&v, src, isBigEndian); return size_t(v); }
+            default:                            throw std::invalid_argument("invalid ply list size type");
+        }
+    };
+
+    for (auto & element : get_elements())
+    {
+        const bool requested = std::find(requestedElements.begin(), requestedElements.end(), element.name) != requestedElements.end();
+        // resolve cursors and strides once per element; unrequested elements are decoded into nothing to skip them
+        std::vector<DataCursor *> cursors;
+        std::vector<int> strides, listStrides;
+        bool hasList = false;
+        int rowStride = 0;
+        for (auto & property : element.properties)
+        {
+            cursors.push_back(requested ? userDataTable[make_key(element.name, property.name)].get() : nullptr);
+            strides.push_back(PropertyTable[property.propertyType].stride);
+            listStrides.push_back(property.isList ? PropertyTable[property.listType].stride : 0);
+            hasList = hasList || property.isList;
+            rowStride += strides.back();
+        }
+
+        for (size_t count = 0; count < element.size; ++count)
+        {
+            // rows without lists have a fixed size and come out of the block at once
+            const char * row = hasList ? nullptr : take(rowStride);
+            for (size_t pi = 0; pi < element.properties.size(); ++pi)
+            {
+                auto & property = element.properties[pi];
+                DataCursor * cursor = cursors[pi];
+                const int stride = strides[pi];
+                if (!property.isList)
+                {
+                    const char * src = row ? row : take(stride);
+                    if (row) row += stride;
+                    if (cursor)
+                    {
+                        decode(property.propertyType, stride, cursor->data + cursor->offset, src);
+                        cursor->offset += stride;
+                    }
+                    continue;
+                }
+
+                const size_t listSize = decode_size(property.listType, take(listStrides[pi]));
+                const char * src = take(listSize * stride);
+                if (!cursor) continue;
+                if (cursor->realloc == false)
+                {
+                    cursor->realloc = true;
+                    resize_vector(property.propertyType, cursor->vector, listSize * element.size, cursor->data);
+                    cursor->listCapacity = listSize * element.size * stride;
+                }
+                if (cursor->offset + listSize * stride > cursor->listCapacity)
+                    throw std::runtime_error("lists of varying length are not supported: " + element.name + " " + property.name);
+                for (size_t i = 0; i < listSize; ++i)
+                {
+                    decode(property.propertyType, stride, cursor->data + cursor->offset, src + i * stride);
+                    cursor->offset += stride;
+                }
+            }
+        }
+    }
+}